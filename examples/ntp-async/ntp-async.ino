@@ -0,0 +1,44 @@
+// Example sketch for TinyNTPClient using the non-blocking update (e.g. on ESP32)
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include "TinyNTPClient.h"
+
+TinyNTPClient<WiFiUDP> ntp;
+const char* ssid = "SSID";
+const char* password = "PASSWORD";
+
+void connectToWiFi() {
+  Serial.print("Connecting to WiFi");
+  WiFi.begin(ssid, password);
+  while (WiFi.status() != WL_CONNECTED) {
+    delay(500);
+    Serial.print(".");
+  }
+  Serial.println("\nWiFi connected");
+}
+
+void setup() {
+  Serial.begin(115200);
+  ntp.setLogger(Serial);
+  connectToWiFi();
+}
+
+void loop() {
+  // Never blocks: sends the request when an update is due (the interval
+  // adapts to the measured jitter) and processes the response when it has
+  // arrived
+  switch (ntp.loop()) {
+    case NTPState::RECEIVED:
+      Serial.print("Current time (UTC): ");
+      Serial.println(ntp.getTimeSec());
+      break;
+    case NTPState::TIMEOUT:
+    case NTPState::FAILED:
+      Serial.println("NTP update failed");
+      break;
+    default:
+      break;
+  }
+
+  // ... do other work here
+}
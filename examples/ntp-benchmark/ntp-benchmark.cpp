@@ -0,0 +1,243 @@
+// Benchmark of TinyNTPClient: call cost of the time functions, latency of
+// the updates and accuracy of the offset against a scripted mock network.
+// Set the environment variable NTP_BENCH_SERVER (e.g. pool.ntp.org) to
+// measure against a real server instead.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// room for the requests of the clients of benchmarkManager()
+#define NTP_MOCK_MAX_QUEUE 128
+#include "Arduino.h"
+#include "WiFiUdp.h"
+#include "TinyNTPClient.h"
+#include "TinyNTPClientManager.h"
+#include "TinyNTPMockUDP.h"
+
+using Clock = std::chrono::steady_clock;
+volatile uint64_t sink;
+
+double nsSince(Clock::time_point start, int n) {
+  return std::chrono::duration<double, std::nano>(Clock::now() - start)
+             .count() / n;
+}
+
+void printPercentiles(const char* name, std::vector<double> values,
+                      const char* unit) {
+  if (values.empty()) {
+    printf("  %-22s no values\n", name);
+    return;
+  }
+  std::sort(values.begin(), values.end());
+  auto at = [&](double p) { return values[(values.size() - 1) * p]; };
+  printf("  %-22s p50 %10.1f  p90 %10.1f  p99 %10.1f  max %10.1f %s\n", name,
+         at(0.5), at(0.9), at(0.99), values.back(), unit);
+}
+
+/// ns per call of the time functions
+template <typename CLIENT>
+void benchmarkCalls(CLIENT& ntp) {
+  const int n = 1000000;
+  printf("Call cost:\n");
+  auto start = Clock::now();
+  for (int j = 0; j < n; j++) sink = ntp.getTimeMs();
+  printf("  %-22s %8.1f ns\n", "getTimeMs()", nsSince(start, n));
+
+  start = Clock::now();
+  for (int j = 0; j < n; j++) sink = ntp.getTimeUs();
+  printf("  %-22s %8.1f ns\n", "getTimeUs()", nsSince(start, n));
+
+  start = Clock::now();
+  for (int j = 0; j < n; j++) sink = ntp.getTm().tm_sec;
+  printf("  %-22s %8.1f ns\n", "getTm()", nsSince(start, n));
+
+  std::vector<uint32_t> ticks(n);
+  std::vector<uint64_t> stamps(n);
+  // ticks of the clock of the client: the lower 32 bits as toUs() expects
+  uint32_t now = static_cast<uint32_t>(ntp.getClock().nowUs());
+  for (int j = 0; j < n; j++) ticks[j] = now + j;
+  start = Clock::now();
+  ntp.getSnapshot().toUs(ticks.data(), stamps.data(), n);
+  sink = stamps[n / 2];
+  printf("  %-22s %8.1f ns / sample\n", "getSnapshot().toUs()",
+         nsSince(start, n));
+}
+
+/// Offset error and latency with the scripted network
+void benchmarkMock(const char* name, const NTPMockNetwork::Server& server,
+                   int burst) {
+  const int syncs = 500;
+  NTPMockNetwork& network = NTPMockNetwork::instance();
+  network.reset();
+  network.setDriftPpb(20000);
+  network.server() = server;
+  TinyNTPClient<NTPMockUDP, 1, NTPMockClock> ntp;
+  std::vector<double> error, latency, cpu;
+  int failures = 0;
+  for (int j = 0; j < syncs; j++) {
+    uint64_t startSim = network.trueUs();
+    auto start = Clock::now();
+    bool ok = ntp.updateBurst(burst);
+    cpu.push_back(nsSince(start, 1));
+    latency.push_back((network.trueUs() - startSim) / 1000.0);
+    if (!ok) {
+      failures++;
+    } else {
+      int64_t diff =
+          static_cast<int64_t>(ntp.getTimeUs() - network.unixUs());
+      error.push_back(diff < 0 ? -diff : diff);
+    }
+    network.advance(64000000);  // next poll
+  }
+  printf("%s (burst %d): %d/%d failed\n", name, burst, failures, syncs);
+  printPercentiles("offset error", error, "us");
+  printPercentiles("sync latency", latency, "ms");
+  printPercentiles("update() cpu", cpu, "ns");
+}
+
+/// Sent requests and offset error of loop() with and without broadcasts
+void benchmarkBroadcast(bool broadcast) {
+  const uint64_t hour = 3600000000ULL;
+  NTPMockNetwork& network = NTPMockNetwork::instance();
+  network.reset();
+  network.setDriftPpb(20000);
+  network.server().jitterUs = 1000;
+  if (broadcast) network.setBroadcast(64000);
+  TinyNTPClient<NTPMockUDP, 1, NTPMockClock> ntp;
+  if (broadcast) {
+    ntp.beginBroadcast();
+  } else {
+    ntp.begin();
+  }
+  std::vector<double> error;
+  while (network.trueUs() < hour) {
+    ntp.loop();
+    network.advance(100);
+    if (network.trueUs() % 1000000ULL < 200) {  // sample every second
+      int64_t diff =
+          static_cast<int64_t>(ntp.getTimeUs() - network.unixUs());
+      error.push_back(diff < 0 ? -diff : diff);
+    }
+  }
+  printf("%s (1 hour): %u requests sent\n",
+         broadcast ? "broadcast 64 s" : "unicast loop()",
+         network.getRequestCount());
+  printPercentiles("offset error", error, "us");
+}
+
+/// Offset error of loop() called every 5 ms with and without driver
+/// receive timestamps
+void benchmarkTimestamps(bool driver) {
+  NTPMockNetwork& network = NTPMockNetwork::instance();
+  network.reset();
+  network.setDriftPpb(20000);
+  network.setDriverTimestamps(driver);
+  TinyNTPClient<NTPMockUDP, 1, NTPMockClock> ntp;
+  ntp.begin();
+  ntp.getUDP().setStepUs(0);  // the time only advances between the loops
+  std::vector<double> error;
+  while (network.trueUs() < 4 * 3600000000ULL) {
+    if (ntp.loop() == NTPState::RECEIVED) {
+      int64_t diff =
+          static_cast<int64_t>(ntp.getTimeUs() - network.unixUs());
+      error.push_back(diff < 0 ? -diff : diff);
+    }
+    network.advance(5000);
+  }
+  printf("loop() every 5 ms, %s timestamps:\n", driver ? "driver" : "no");
+  printPercentiles("offset error", error, "us");
+}
+
+/// Cost of TinyNTPClientManager::loop() and offset error with 100 clients
+/// on one socket
+void benchmarkManager() {
+  using Manager = TinyNTPClientManager<NTPMockUDP, 100, NTPMockClock, 1>;
+  NTPMockNetwork& network = NTPMockNetwork::instance();
+  network.reset();
+  network.setDriftPpb(20000);
+  network.server().jitterUs = 1000;
+  static Manager manager;
+  static std::vector<Manager::Client> clients(100);
+  manager.begin();
+  manager.getUDP().setStepUs(0);
+  for (auto& client : clients) manager.add(client);
+  std::vector<double> error, cpu;
+  while (network.trueUs() < 3600000000ULL) {
+    auto start = Clock::now();
+    manager.loop();
+    cpu.push_back(nsSince(start, 1));
+    network.advance(1000);
+  }
+  for (auto& client : clients) {
+    int64_t diff =
+        static_cast<int64_t>(client.getTimeUs() - network.unixUs());
+    error.push_back(diff < 0 ? -diff : diff);
+  }
+  printf("manager, 100 clients (1 hour): %u requests, %u unmatched\n",
+         network.getRequestCount(), manager.getUnmatchedCount());
+  printPercentiles("offset error", error, "us");
+  printPercentiles("loop() cpu", cpu, "ns");
+}
+
+/// Latency and offset (against the system clock) with a real server
+void benchmarkServer(const char* server) {
+  const int syncs = 10;
+  TinyNTPClient<WiFiUDP> ntp(server);
+  std::vector<double> offset, latency;
+  int failures = 0;
+  for (int j = 0; j < syncs; j++) {
+    auto start = Clock::now();
+    if (!ntp.update()) {
+      failures++;
+    } else {
+      latency.push_back(nsSince(start, 1) / 1000000.0);
+      // the first update sets the clock
+      if (j > 0) offset.push_back(ntp.getOffsetUs() / 1000.0);
+    }
+    delay(1000);
+  }
+  printf("%s: %d/%d failed\n", server, failures, syncs);
+  printPercentiles("sync latency", latency, "ms");
+  printPercentiles("corrected offset", offset, "ms");
+  if (ntp) benchmarkCalls(ntp);
+}
+
+void setup() {
+  const char* server = getenv("NTP_BENCH_SERVER");
+  if (server != nullptr) {
+    benchmarkServer(server);
+    exit(0);
+  }
+
+  NTPMockNetwork::Server symmetric;
+  benchmarkMock("symmetric 10 ms", symmetric, 1);
+
+  NTPMockNetwork::Server asymmetric;
+  asymmetric.upUs = 5000;
+  asymmetric.downUs = 25000;
+  benchmarkMock("asymmetric 5/25 ms", asymmetric, 1);
+
+  NTPMockNetwork::Server jitter;
+  jitter.jitterUs = 10000;
+  jitter.lossPercent = 10;
+  benchmarkMock("jitter 10 ms, 10% loss", jitter, 1);
+  benchmarkMock("jitter 10 ms, 10% loss", jitter, 4);
+
+  benchmarkBroadcast(false);
+  benchmarkBroadcast(true);
+  benchmarkTimestamps(false);
+  benchmarkTimestamps(true);
+  benchmarkManager();
+
+  // real time clock for the call cost
+  NTPMockNetwork::instance().reset();
+  NTPMockNetwork::instance().setRealTime(true);
+  TinyNTPClient<NTPMockUDP, 1, NTPMockClock> ntp;
+  ntp.begin();
+  benchmarkCalls(ntp);
+  exit(0);
+}
+
+void loop() {}
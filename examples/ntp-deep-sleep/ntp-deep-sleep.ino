@@ -0,0 +1,54 @@
+// Example sketch for TinyNTPClient with deep sleep on an ESP32: the sync
+// state is kept in RTC memory, so after the wake up the time is valid
+// immediately and the network is only used when the next update is due
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include <sys/time.h>
+#include "TinyNTPClient.h"
+
+TinyNTPClient<WiFiUDP> ntp("pool.ntp.org");
+RTC_DATA_ATTR NTPSyncState state;
+const char* ssid = "SSID";
+const char* password = "PASSWORD";
+const uint64_t sleepUs = 60000000ULL;  // 1 minute
+
+// The system time of the ESP32 is kept by the RTC timer during deep sleep
+uint64_t rtcUs() {
+  timeval tv;
+  gettimeofday(&tv, nullptr);
+  return static_cast<uint64_t>(tv.tv_sec) * 1000000ULL + tv.tv_usec;
+}
+
+void connectToWiFi() {
+  Serial.print("Connecting to WiFi");
+  WiFi.begin(ssid, password);
+  while (WiFi.status() != WL_CONNECTED) {
+    delay(500);
+    Serial.print(".");
+  }
+  Serial.println("\nWiFi connected");
+}
+
+void setup() {
+  Serial.begin(115200);
+  ntp.setLogger(Serial);
+
+  // Continue with the saved state or synchronize from scratch
+  if (!ntp.restoreState(state, rtcUs())) {
+    connectToWiFi();
+    ntp.begin();
+  } else if (ntp.needsUpdate()) {
+    connectToWiFi();
+    ntp.update();
+  }
+
+  if (ntp) {
+    Serial.print("Current time (UTC): ");
+    Serial.println(ntp.getTimeSec());
+  }
+
+  ntp.saveState(state, rtcUs());
+  esp_deep_sleep(sleepUs);
+}
+
+void loop() {}
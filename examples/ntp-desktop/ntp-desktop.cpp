@@ -7,6 +7,7 @@
 TinyNTPClient<WiFiUDP> ntp;
 
 void setup() {
+  ntp.setLogger(Serial);
   if (!ntp.begin()) {
     Serial.println("Failed to initialize NTP client");
     exit(1);
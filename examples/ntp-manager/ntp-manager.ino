@@ -0,0 +1,50 @@
+// Example sketch for TinyNTPClientManager: an ESP32 monitors several
+// reference servers with one UDP socket and prints their offsets
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include "TinyNTPClient.h"
+#include "TinyNTPClientManager.h"
+
+using Manager = TinyNTPClientManager<WiFiUDP, 4>;
+Manager manager;
+Manager::Client clients[] = {{"time.google.com"},
+                             {"time.cloudflare.com"},
+                             {"ptbtime1.ptb.de"},
+                             {"pool.ntp.org"}};
+const char* ssid = "SSID";
+const char* password = "PASSWORD";
+
+void connectToWiFi() {
+  Serial.print("Connecting to WiFi");
+  WiFi.begin(ssid, password);
+  while (WiFi.status() != WL_CONNECTED) {
+    delay(500);
+    Serial.print(".");
+  }
+  Serial.println("\nWiFi connected");
+}
+
+void setup() {
+  Serial.begin(115200);
+  connectToWiFi();
+
+  // One socket for all clients: loop() starts their first update
+  manager.begin();
+  for (auto& client : clients) {
+    client.setLogger(Serial);
+    manager.add(client);
+  }
+}
+
+void loop() {
+  manager.wait(10);  // polls the socket until a packet arrives
+  if (manager.loop() > 0) {
+    for (auto& client : clients) {
+      Serial.print(client.getStats().stratum);
+      Serial.print(" ");
+      Serial.print(static_cast<int>(client.getOffsetUs()));
+      Serial.print(" us; ");
+    }
+    Serial.println();
+  }
+}
@@ -0,0 +1,48 @@
+// Example sketch for the TinyNTPTimeService on the ESP32: a background task
+// keeps the time up to date and any task reads it without locking
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include "TinyNTPTimeService.h"
+
+TinyNTPTimeService<WiFiUDP> ntp;
+const char* ssid = "SSID";
+const char* password = "PASSWORD";
+
+void connectToWiFi() {
+  Serial.print("Connecting to WiFi");
+  WiFi.begin(ssid, password);
+  while (WiFi.status() != WL_CONNECTED) {
+    delay(500);
+    Serial.print(".");
+  }
+  Serial.println("\nWiFi connected");
+}
+
+void reader(void*) {
+  while (true) {
+    if (ntp) {
+      Serial.print("Reader task time (ms): ");
+      Serial.println(ntp.getTimeMs());
+    }
+    delay(1000);
+  }
+}
+
+void setup() {
+  Serial.begin(115200);
+  connectToWiFi();
+  // configure the client before the update task is started
+  ntp.client().setLogger(Serial);
+  ntp.setTimeOffsetSeconds(3600);  // CET
+  if (!ntp.startTask()) {
+    Serial.println("Failed to start the NTP task");
+  }
+  xTaskCreate(reader, "reader", 4096, nullptr, 1, nullptr);
+}
+
+void loop() {
+  // the main loop can read the time as well
+  delay(5000);
+  Serial.print("Loop time (s): ");
+  Serial.println(ntp.getTimeSec());
+}
@@ -0,0 +1,44 @@
+// Example sketch for TinyNTPServer: an ESP32 which is synchronized from the
+// internet serves the time to the local network and sends broadcasts
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include "TinyNTPClient.h"
+#include "TinyNTPServer.h"
+
+TinyNTPClient<WiFiUDP> ntp("pool.ntp.org");
+TinyNTPServer<WiFiUDP, TinyNTPClient<WiFiUDP>> server(ntp);
+const char* ssid = "SSID";
+const char* password = "PASSWORD";
+
+void connectToWiFi() {
+  Serial.print("Connecting to WiFi");
+  WiFi.begin(ssid, password);
+  while (WiFi.status() != WL_CONNECTED) {
+    delay(500);
+    Serial.print(".");
+  }
+  Serial.println("\nWiFi connected");
+}
+
+void setup() {
+  Serial.begin(115200);
+  connectToWiFi();
+
+  // Synchronize with the upstream server
+  ntp.setLogger(Serial);
+  if (!ntp.begin()) {
+    Serial.println("Failed to initialize NTP client");
+  }
+
+  // Answer the requests of the local network on port 123
+  server.begin();
+  // Send a broadcast every 64 seconds
+  server.setBroadcast(IPAddress(255, 255, 255, 255), 64000);
+  Serial.print("NTP server running on ");
+  Serial.println(WiFi.localIP());
+}
+
+void loop() {
+  ntp.loop();     // keep the upstream time up to date
+  server.loop();  // answer the requests as soon as possible
+}
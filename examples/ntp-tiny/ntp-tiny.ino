@@ -0,0 +1,45 @@
+// Example sketch for TinyNTPClient with the minimal memory configuration:
+// a single server, one shared packet buffer, no getTm() cache and no logging
+#define NTP_TINY 1
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include "TinyNTPClient.h"
+
+TinyNTPClient<WiFiUDP> ntp;
+const char* ssid = "SSID";
+const char* password = "PASSWORD";
+
+// Memory budget for the client state on top of the UDP object: the bound
+// applies to 32-bit targets (ESP32, ARM). 64-bit hosts can need more for
+// the pointers and the padding after the UDP object.
+static_assert(sizeof(ntp) - sizeof(WiFiUDP) <= 256,
+              "NTP client state exceeds the budget");
+
+void connectToWiFi() {
+  Serial.print("Connecting to WiFi");
+  WiFi.begin(ssid, password);
+  while (WiFi.status() != WL_CONNECTED) {
+    delay(500);
+    Serial.print(".");
+  }
+  Serial.println("\nWiFi connected");
+}
+
+void setup() {
+  Serial.begin(115200);
+  connectToWiFi();
+  Serial.print("NTP client state (bytes): ");
+  Serial.println(sizeof(ntp) - sizeof(WiFiUDP));
+}
+
+void loop() {
+  if (ntp.loop() == NTPState::RECEIVED) {
+    Serial.print("Current time (UTC): ");
+    Serial.println(ntp.getTimeSec());
+#ifdef ESP32
+    // Report the unused stack of the loop task
+    Serial.print("Stack high water mark (bytes): ");
+    Serial.println(uxTaskGetStackHighWaterMark(nullptr));
+#endif
+  }
+}
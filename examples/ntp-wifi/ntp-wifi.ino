@@ -23,6 +23,7 @@ void setup() {
 
   // Initialize NTP client
   Serial.println("Starting NTP client...");
+  ntp.setLogger(Serial);
   if (!ntp.begin()) {
     Serial.println("Failed to initialize NTP client");
     return;
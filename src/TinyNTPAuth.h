@@ -0,0 +1,265 @@
+
+/**
+ * @file TinyNTPAuth.h
+ * @brief Symmetric key authentication of NTP packets (RFC 5905, RFC 8573):
+ * AES-128-CMAC message authentication codes with a precomputed key
+ * schedule, compatible with the AES128CMAC keys of ntpd and chrony.
+ */
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/// Size of the MAC which is appended to a packet: key id and digest
+#define NTP_MAC_SIZE 20
+
+/**
+ * @brief Symmetric key (key id and AES-128 key): the AES key schedule and
+ * the CMAC subkeys are computed once by the constructor or begin(), so
+ * that a MAC costs only one AES block per 16 bytes of the packet. The key
+ * must stay valid while it is used by a client or server.
+ */
+class NTPSymmetricKey {
+ public:
+  NTPSymmetricKey() = default;
+
+  /**
+   * @brief Define the key.
+   * @param keyId Key id (1 - 65535 as in the keys file of ntpd)
+   * @param key 16 bytes of the key
+   */
+  NTPSymmetricKey(uint32_t keyId, const uint8_t* key) { begin(keyId, key); }
+
+  /**  @brief Define the key and compute the key schedule. */
+  void begin(uint32_t keyId, const uint8_t* key) {
+    _keyId = keyId;
+    expandKey(key);
+    // CMAC subkeys (RFC 4493): L = AES(0), K1 = L << 1, K2 = K1 << 1
+    uint8_t l[16] = {};
+    encrypt(l);
+    shift(l, _k1);
+    shift(_k1, _k2);
+  }
+
+  /**  @brief Key id which is sent with the MAC. */
+  uint32_t getKeyId() const { return _keyId; }
+
+  /**  @brief Encrypt one block in place (AES-128). */
+  void encrypt(uint8_t* block) const {
+    addRoundKey(block, _roundKeys);
+    for (int round = 1; round < 10; round++) {
+      subShift(block);
+      mixColumns(block);
+      addRoundKey(block, _roundKeys + 16 * round);
+    }
+    subShift(block);
+    addRoundKey(block, _roundKeys + 160);
+  }
+
+  /**
+   * @brief Write the MAC (key id and CMAC of the packet) to the UDP API
+   * after the packet.
+   * @param udp UDP API after writing the packet
+   * @param packet Packet (48 bytes)
+   */
+  template <typename UDPAPI>
+  void write(UDPAPI& udp, const uint8_t* packet) const;
+
+  /**
+   * @brief Read the MAC of a received packet from the UDP API and check it:
+   * the extension fields between the packet and the MAC are authenticated
+   * as well. A packet without MAC or with a crypto-NAK is rejected.
+   * @param udp UDP API after reading the packet
+   * @param packet Packet (48 bytes)
+   * @param packetSize Size of the packet as reported by parsePacket()
+   * @return true if the packet has been authenticated with this key.
+   */
+  template <typename UDPAPI>
+  bool verify(UDPAPI& udp, const uint8_t* packet, int packetSize) const;
+
+ protected:
+  friend class NTPCmac;
+  uint8_t _roundKeys[176];
+  uint8_t _k1[16];
+  uint8_t _k2[16];
+  uint32_t _keyId = 0;
+
+  static const uint8_t* sbox() {
+    static const uint8_t table[256] = {
+        0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b,
+        0xfe, 0xd7, 0xab, 0x76, 0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0,
+        0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0, 0xb7, 0xfd, 0x93, 0x26,
+        0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+        0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2,
+        0xeb, 0x27, 0xb2, 0x75, 0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0,
+        0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84, 0x53, 0xd1, 0x00, 0xed,
+        0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+        0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f,
+        0x50, 0x3c, 0x9f, 0xa8, 0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5,
+        0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2, 0xcd, 0x0c, 0x13, 0xec,
+        0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+        0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14,
+        0xde, 0x5e, 0x0b, 0xdb, 0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c,
+        0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79, 0xe7, 0xc8, 0x37, 0x6d,
+        0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+        0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f,
+        0x4b, 0xbd, 0x8b, 0x8a, 0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e,
+        0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e, 0xe1, 0xf8, 0x98, 0x11,
+        0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+        0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f,
+        0xb0, 0x54, 0xbb, 0x16};
+    return table;
+  }
+
+  static uint8_t xtime(uint8_t x) {
+    return static_cast<uint8_t>((x << 1) ^ ((x & 0x80) ? 0x1b : 0));
+  }
+
+  void expandKey(const uint8_t* key) {
+    const uint8_t* s = sbox();
+    memcpy(_roundKeys, key, 16);
+    uint8_t rcon = 1;
+    for (int i = 16; i < 176; i += 4) {
+      uint8_t t[4];
+      memcpy(t, _roundKeys + i - 4, 4);
+      if (i % 16 == 0) {
+        uint8_t first = t[0];
+        t[0] = s[t[1]] ^ rcon;
+        t[1] = s[t[2]];
+        t[2] = s[t[3]];
+        t[3] = s[first];
+        rcon = xtime(rcon);
+      }
+      for (int j = 0; j < 4; j++) {
+        _roundKeys[i + j] = _roundKeys[i - 16 + j] ^ t[j];
+      }
+    }
+  }
+
+  static void addRoundKey(uint8_t* block, const uint8_t* roundKey) {
+    for (int j = 0; j < 16; j++) block[j] ^= roundKey[j];
+  }
+
+  /**  @brief SubBytes and ShiftRows (column major state). */
+  static void subShift(uint8_t* b) {
+    const uint8_t* s = sbox();
+    uint8_t t[16];
+    for (int j = 0; j < 16; j++) t[j] = s[b[(j + 4 * (j % 4)) % 16]];
+    memcpy(b, t, 16);
+  }
+
+  static void mixColumns(uint8_t* b) {
+    for (int c = 0; c < 16; c += 4) {
+      uint8_t a0 = b[c], a1 = b[c + 1], a2 = b[c + 2], a3 = b[c + 3];
+      uint8_t all = a0 ^ a1 ^ a2 ^ a3;
+      b[c] ^= all ^ xtime(a0 ^ a1);
+      b[c + 1] ^= all ^ xtime(a1 ^ a2);
+      b[c + 2] ^= all ^ xtime(a2 ^ a3);
+      b[c + 3] ^= all ^ xtime(a3 ^ a0);
+    }
+  }
+
+  /**  @brief Shift left by one bit in GF(2^128) (CMAC subkeys). */
+  static void shift(const uint8_t* in, uint8_t* out) {
+    uint8_t carry = 0;
+    for (int j = 15; j >= 0; j--) {
+      uint8_t next = in[j] >> 7;
+      out[j] = static_cast<uint8_t>(in[j] << 1 | carry);
+      carry = next;
+    }
+    if (carry) out[15] ^= 0x87;
+  }
+};
+
+/**
+ * @brief AES-128-CMAC (RFC 4493) of a message which is provided in pieces.
+ */
+class NTPCmac {
+ public:
+  explicit NTPCmac(const NTPSymmetricKey& key) : _key(key) {}
+
+  /**  @brief Add data to the message. */
+  void update(const uint8_t* data, size_t len) {
+    while (len > 0) {
+      // the last block is processed by finish()
+      if (_count == 16) {
+        for (int j = 0; j < 16; j++) _x[j] ^= _buffer[j];
+        _key.encrypt(_x);
+        _count = 0;
+      }
+      size_t n = 16U - _count < len ? 16U - _count : len;
+      memcpy(_buffer + _count, data, n);
+      _count += static_cast<uint8_t>(n);
+      data += n;
+      len -= n;
+    }
+  }
+
+  /**  @brief Compute the MAC (16 bytes). */
+  void finish(uint8_t* mac) {
+    const uint8_t* subkey = _key._k1;
+    if (_count < 16) {
+      // incomplete last block: padding 10..0 and K2
+      _buffer[_count++] = 0x80;
+      while (_count < 16) _buffer[_count++] = 0;
+      subkey = _key._k2;
+    }
+    for (int j = 0; j < 16; j++) mac[j] = _x[j] ^ _buffer[j] ^ subkey[j];
+    _key.encrypt(mac);
+  }
+
+  /**  @brief Compare in constant time (no early exit). */
+  static bool equals(const uint8_t* a, const uint8_t* b, size_t len) {
+    uint8_t diff = 0;
+    for (size_t j = 0; j < len; j++) diff |= a[j] ^ b[j];
+    return diff == 0;
+  }
+
+ protected:
+  const NTPSymmetricKey& _key;
+  uint8_t _x[16] = {};
+  uint8_t _buffer[16];
+  uint8_t _count = 0;
+};
+
+template <typename UDPAPI>
+void NTPSymmetricKey::write(UDPAPI& udp, const uint8_t* packet) const {
+  uint8_t mac[NTP_MAC_SIZE];
+  for (int j = 0; j < 4; j++) {
+    mac[j] = static_cast<uint8_t>(_keyId >> (24 - 8 * j));
+  }
+  NTPCmac cmac(*this);
+  cmac.update(packet, 48);
+  cmac.finish(mac + 4);
+  udp.write(mac, sizeof(mac));
+}
+
+template <typename UDPAPI>
+bool NTPSymmetricKey::verify(UDPAPI& udp, const uint8_t* packet,
+                             int packetSize) const {
+  int extension = packetSize - 48 - NTP_MAC_SIZE;
+  if (extension < 0) return false;
+  NTPCmac cmac(*this);
+  cmac.update(packet, 48);
+  uint8_t buffer[NTP_MAC_SIZE];
+  int len = 0;
+  while (len < NTP_MAC_SIZE) {
+    int size = extension > 0 ? (extension < NTP_MAC_SIZE ? extension
+                                                         : NTP_MAC_SIZE)
+                             : NTP_MAC_SIZE - len;
+    int n = udp.read(buffer + len, size);
+    if (n <= 0) return false;
+    if (extension > 0) {
+      cmac.update(buffer, n);  // extension field
+      extension -= n;
+    } else {
+      len += n;
+    }
+  }
+  uint32_t keyId = 0;
+  for (int j = 0; j < 4; j++) keyId = keyId << 8 | buffer[j];
+  uint8_t mac[16];
+  cmac.finish(mac);
+  return keyId == _keyId && NTPCmac::equals(mac, buffer + 4, 16);
+}
@@ -7,11 +7,824 @@
  */
 
 #pragma once
-#include <cstdarg>
+#include <cstddef>
 #include <cstdint>
-#include <cstdio>
 #include <ctime>
 
+/// Tiny configuration (#define NTP_TINY 1): minimal object state and stack
+/// usage - a single server, one shared packet buffer, no getTm() cache and
+/// no logging
+#ifndef NTP_TINY
+#define NTP_TINY 0
+#endif
+
+/// Default maximum number of servers which are queried together
+#ifndef NTP_MAX_SERVERS
+#define NTP_MAX_SERVERS (NTP_TINY ? 1 : 4)
+#endif
+
+/// Maximum number of requests in flight: servers * burst size
+#ifndef NTP_MAX_REQUESTS
+#define NTP_MAX_REQUESTS (NTP_TINY ? 1 : 8)
+#endif
+
+/// Cache the result of getTm()
+#ifndef NTP_TM_CACHE
+#define NTP_TM_CACHE (!NTP_TINY)
+#endif
+
+/// Support POSIX TZ rules with setTimeZone()
+#ifndef NTP_TIMEZONE
+#define NTP_TIMEZONE (!NTP_TINY)
+#endif
+
+/// Log levels for NTP_LOG_LEVEL
+#define NTP_LOG_NONE 0
+#define NTP_LOG_ERROR 1
+#define NTP_LOG_WARNING 2
+#define NTP_LOG_INFO 3
+
+/// Compile-time log level: messages above this level are removed
+#ifndef NTP_LOG_LEVEL
+#define NTP_LOG_LEVEL (NTP_TINY ? NTP_LOG_NONE : NTP_LOG_WARNING)
+#endif
+
+/// Number of attempts of an update: unanswered requests are retransmitted
+#ifndef NTP_MAX_ATTEMPTS
+#define NTP_MAX_ATTEMPTS 3
+#endif
+
+/// Timeout of an attempt in milliseconds (upper limit of the adaptive one)
+#ifndef NTP_ATTEMPT_TIMEOUT_MS
+#define NTP_ATTEMPT_TIMEOUT_MS 1000
+#endif
+
+/// Lower limit of the adaptive attempt timeout in milliseconds
+#ifndef NTP_MIN_ATTEMPT_TIMEOUT_MS
+#define NTP_MIN_ATTEMPT_TIMEOUT_MS 100
+#endif
+
+/// Adaptive attempt timeout: multiple of the smoothed round-trip time
+#ifndef NTP_RTT_FACTOR
+#define NTP_RTT_FACTOR 4
+#endif
+
+/// Cache the server addresses resolved with setResolver()
+#ifndef NTP_DNS_CACHE
+#define NTP_DNS_CACHE (!NTP_TINY)
+#endif
+
+/// Number of cached addresses per server (e.g. of a pool)
+#ifndef NTP_DNS_ADDRESSES
+#define NTP_DNS_ADDRESSES 4
+#endif
+
+/// Time after which the cached addresses are resolved again
+#ifndef NTP_DNS_TTL_MS
+#define NTP_DNS_TTL_MS 3600000UL
+#endif
+
+/// Listen-only mode: discipline the clock from broadcasts (mode 5)
+#ifndef NTP_BROADCAST
+#define NTP_BROADCAST (!NTP_TINY)
+#endif
+
+/// Symmetric key authentication with setKey() (AES-128-CMAC)
+#ifndef NTP_AUTH
+#define NTP_AUTH (!NTP_TINY)
+#endif
+
+#if NTP_AUTH
+#include "TinyNTPAuth.h"
+#endif
+
+#if NTP_DNS_CACHE
+/**
+ * @brief Function which resolves a host name (e.g. with WiFi.hostByName()).
+ * @return true if the address was found.
+ */
+typedef bool (*NTPResolver)(const char* host, IPAddress& result);
+#endif
+
+/// Byte order of the target: detected at compile time
+#ifndef NTP_BIG_ENDIAN
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) && \
+    __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define NTP_BIG_ENDIAN 1
+#else
+#define NTP_BIG_ENDIAN 0
+#endif
+#endif
+
+/// First byte of a client request: LI=3 (unsynchronized), VN=3, Mode=3
+#define NTP_CLIENT_HEADER 0xDB
+
+/**
+ * @brief States of a (non-blocking) NTP update: see
+ * TinyNTPClient::startUpdate() and TinyNTPClient::poll().
+ */
+enum class NTPState : uint8_t {
+  IDLE,      ///< No request in progress
+  SENT,      ///< Request sent, waiting for the response
+  RECEIVED,  ///< Valid response received and time updated
+  TIMEOUT,   ///< No response received within the timeout
+  FAILED     ///< Invalid or incomplete response
+};
+
+/**
+ * @brief Result of the last update: see NTPStats::error.
+ */
+enum class NTPError : uint8_t {
+  NONE,              ///< The update was successful
+  SOCKET,            ///< The local UDP port could not be bound
+  SEND,              ///< No request could be sent (e.g. unknown host)
+  TIMEOUT,           ///< No server has answered in time
+  INVALID_RESPONSE,  ///< Responses too short, malformed or not matching
+  UNSYNCHRONIZED,    ///< The servers are not synchronized (LI 3, stratum 16)
+  KISS_OF_DEATH,     ///< The servers have sent a kiss-o'-death
+  AUTHENTICATION,    ///< Responses without a valid MAC (see setKey())
+  NO_MAJORITY        ///< No majority of the servers agrees on the time
+};
+
+/**
+ * @brief Statistics of the updates of a TinyNTPClient: see
+ * TinyNTPClient::getStats().
+ */
+struct NTPStats {
+  int64_t offsetUs = 0;        ///< Offset corrected by the last update
+  int32_t delayUs = 0;         ///< Round-trip delay of the last update
+  int32_t minDelayUs = 0;      ///< Lowest round-trip delay (0: none yet)
+  int32_t jitterUs = 0;        ///< Estimated jitter of the offset
+  uint32_t exchangeUs = 0;     ///< Duration of the last exchange
+  uint32_t successCount = 0;   ///< Number of successful updates
+  uint32_t timeoutCount = 0;   ///< Number of updates which timed out
+  uint32_t failureCount = 0;   ///< Number of updates failed otherwise
+  uint16_t rejectedCount = 0;  ///< Number of ignored responses
+  uint16_t retryCount = 0;     ///< Number of retransmissions
+  uint8_t stratum = 0;         ///< Stratum of the selected server
+  NTPError error = NTPError::NONE;  ///< Result of the last update
+};
+
+/// Correct the transmit timestamp by the TX timestamps of the UDP API
+#ifndef NTP_TX_TIMESTAMPS
+#define NTP_TX_TIMESTAMPS (!NTP_TINY)
+#endif
+
+/// Tag the transmit timestamps, e.g. for a socket shared by several clients
+#ifndef NTP_REQUEST_TAG
+#define NTP_REQUEST_TAG (!NTP_TINY)
+#endif
+
+/// Compile time boolean for the overload resolution
+template <bool VALUE>
+struct NTPBool {};
+
+/**
+ * @brief Driver timestamps of an UDP API: by default the UDP API is used if
+ * it provides bool getRxAgeUs(uint32_t&) and / or bool getTxAgeUs(uint32_t&)
+ * which report the microseconds since the current packet was received (e.g.
+ * SO_TIMESTAMPNS, lwIP or an interrupt of the network chip) and since the
+ * last packet has been sent. Specialize it for an UDP API which can not be
+ * changed. Without timestamps the time is captured when the packet is
+ * processed.
+ */
+template <typename UDPAPI>
+struct NTPTimestampTraits {
+  /**  @brief Age of the current received packet: false if not available. */
+  static bool getRxAgeUs(UDPAPI& udp, uint32_t& ageUs) {
+    return rx(udp, ageUs, NTPBool<hasRx<UDPAPI>(nullptr)>());
+  }
+
+  /**  @brief Age of the last sent packet: false if not available. */
+  static bool getTxAgeUs(UDPAPI& udp, uint32_t& ageUs) {
+    return tx(udp, ageUs, NTPBool<hasTx<UDPAPI>(nullptr)>());
+  }
+
+ protected:
+  template <typename U>
+  static constexpr bool hasRx(decltype(&U::getRxAgeUs)) {
+    return true;
+  }
+  template <typename U>
+  static constexpr bool hasRx(...) {
+    return false;
+  }
+  template <typename U>
+  static constexpr bool hasTx(decltype(&U::getTxAgeUs)) {
+    return true;
+  }
+  template <typename U>
+  static constexpr bool hasTx(...) {
+    return false;
+  }
+  static bool rx(UDPAPI& udp, uint32_t& ageUs, NTPBool<true>) {
+    return udp.getRxAgeUs(ageUs);
+  }
+  static bool rx(UDPAPI&, uint32_t&, NTPBool<false>) { return false; }
+  static bool tx(UDPAPI& udp, uint32_t& ageUs, NTPBool<true>) {
+    return udp.getTxAgeUs(ageUs);
+  }
+  static bool tx(UDPAPI&, uint32_t&, NTPBool<false>) { return false; }
+};
+
+/// Identifies a saved NTPSyncState (and its layout version)
+#define NTP_STATE_MAGIC 0x4E01
+
+/**
+ * @brief Compact synchronization state of a TinyNTPClient which survives a
+ * deep sleep or a restart, e.g. in RTC memory (RTC_DATA_ATTR) or as NVS
+ * blob: see TinyNTPClient::saveState() and restoreState().
+ */
+struct NTPSyncState {
+  uint64_t timeUs = 0;      ///< UTC microseconds since 1970 at the save
+  uint64_t rtcUs = 0;       ///< Sleep timer (microseconds) at the save
+  uint32_t ageMs = 0;       ///< Time since the last update at the save
+  uint32_t srttUs = 0;      ///< Smoothed round-trip time
+  int32_t driftPpb = 0;     ///< Frequency error of the local clock
+  int32_t offsetSec = 0;    ///< Time offset in seconds
+  uint8_t address[4] = {};  ///< IPv4 address of the last server (0: none)
+  uint16_t magic = 0;       ///< NTP_STATE_MAGIC
+  uint8_t pollExp = 0;      ///< Poll exponent
+  uint8_t server = 0;       ///< Index of the last server
+  uint8_t stratum = 0;      ///< Stratum of the last server
+  uint8_t checksum = 0;     ///< Checksum of the fields
+
+  /**  @brief The state has been saved (and not been corrupted). */
+  bool isValid() const {
+    return magic == NTP_STATE_MAGIC && checksum == computeChecksum();
+  }
+
+  /**  @brief FNV-1a hash of the fields (not of the padding). */
+  uint8_t computeChecksum() const {
+    uint32_t h = 2166136261UL;
+    hash(h, timeUs, 8);
+    hash(h, rtcUs, 8);
+    hash(h, ageMs, 4);
+    hash(h, srttUs, 4);
+    hash(h, static_cast<uint32_t>(driftPpb), 4);
+    hash(h, static_cast<uint32_t>(offsetSec), 4);
+    for (int j = 0; j < 4; j++) hash(h, address[j], 1);
+    hash(h, magic, 2);
+    hash(h, pollExp, 1);
+    hash(h, server, 1);
+    hash(h, stratum, 1);
+    return static_cast<uint8_t>(h ^ h >> 8 ^ h >> 16 ^ h >> 24);
+  }
+
+ protected:
+  static void hash(uint32_t& h, uint64_t value, int bytes) {
+    for (int j = 0; j < bytes; j++) {
+      h = (h ^ static_cast<uint8_t>(value >> (8 * j))) * 16777619UL;
+    }
+  }
+};
+
+/// Local UDP port (0 = ephemeral port selected by the network stack)
+#ifndef NTP_LOCAL_PORT
+#define NTP_LOCAL_PORT 0
+#endif
+
+/// Maximum number of stale datagrams which are dropped before a request
+#ifndef NTP_MAX_DRAIN
+#define NTP_MAX_DRAIN 8
+#endif
+
+/// Minimum dispersion (µs) which is added to the root distance of a server
+#ifndef NTP_MIN_DISPERSION_US
+#define NTP_MIN_DISPERSION_US 1000
+#endif
+
+/// Minimum interval between updates to learn the drift (ms)
+#ifndef NTP_MIN_DRIFT_INTERVAL_MS
+#define NTP_MIN_DRIFT_INTERVAL_MS 60000
+#endif
+
+/// Offsets above this value (µs) are considered a step and not used for drift
+#ifndef NTP_STEP_THRESHOLD_US
+#define NTP_STEP_THRESHOLD_US 128000
+#endif
+
+/// Maximum frequency error of the local clock (ppb)
+#ifndef NTP_MAX_DRIFT_PPB
+#define NTP_MAX_DRIFT_PPB 500000
+#endif
+
+/// Gain of the drift estimation: 1/NTP_DRIFT_GAIN of the residual is applied
+#ifndef NTP_DRIFT_GAIN
+#define NTP_DRIFT_GAIN 2
+#endif
+
+/// Minimum poll exponent: shortest update interval 2^NTP_MIN_POLL s
+#ifndef NTP_MIN_POLL
+#define NTP_MIN_POLL 6
+#endif
+
+/// Maximum poll exponent: longest update interval 2^NTP_MAX_POLL s
+#ifndef NTP_MAX_POLL
+#define NTP_MAX_POLL 12
+#endif
+
+/// Poll exponent of the first retry after a failure (doubled for each retry)
+#ifndef NTP_RETRY_POLL
+#define NTP_RETRY_POLL 4
+#endif
+
+/// The interval grows when the offset is below NTP_POLL_GATE * jitter
+#ifndef NTP_POLL_GATE
+#define NTP_POLL_GATE 4
+#endif
+
+/// Number of stable updates before the interval grows
+#ifndef NTP_POLL_LIMIT
+#define NTP_POLL_LIMIT 2
+#endif
+
+/// Leap seconds announced by the leap indicator are applied to the time
+#ifndef NTP_LEAP
+#define NTP_LEAP (!NTP_TINY)
+#endif
+
+/// Default duration of the leap second smear (ms, 0: step at the leap)
+#ifndef NTP_LEAP_SMEAR_MS
+#define NTP_LEAP_SMEAR_MS 0
+#endif
+
+/// Samples within this time (ms) of the step of the servers at a leap
+/// second are not applied
+#ifndef NTP_LEAP_GUARD_MS
+#define NTP_LEAP_GUARD_MS 10000UL
+#endif
+
+/// Unix time (s) before the first synchronization, by default the build
+/// date: the received timestamps are placed in the NTP era (136 years)
+/// closest to it until the time is known (e.g. after the 2036 rollover)
+#ifndef NTP_BUILD_TIME
+#define NTP_BUILD_TIME NTPCalendar::buildTime(__DATE__)
+#endif
+
+/**
+ * @brief Calendar calculations (proleptic Gregorian, UTC) which do not depend
+ * on gmtime_r(). Based on the days_from_civil / civil_from_days algorithms by
+ * Howard Hinnant.
+ */
+struct NTPCalendar {
+  /**
+   * @brief Days since 1970-01-01 for the indicated date (constexpr, C++11).
+   * @param y Year (e.g. 2025)
+   * @param m Month 1-12
+   * @param d Day 1-31
+   */
+  static constexpr int32_t daysFromCivil(int32_t y, uint32_t m, uint32_t d) {
+    return daysFromCivilShifted(y - (m <= 2 ? 1 : 0), m, d);
+  }
+
+  /**
+   * @brief Unix seconds of a date in the format of __DATE__ (constexpr).
+   * @param date e.g. "Oct 14 2026"
+   */
+  static constexpr int64_t buildTime(const char* date) {
+    return static_cast<int64_t>(daysFromCivil(
+               (date[7] - '0') * 1000 + (date[8] - '0') * 100 +
+                   (date[9] - '0') * 10 + (date[10] - '0'),
+               monthOf(date),
+               (date[4] == ' ' ? 0 : date[4] - '0') * 10 + (date[5] - '0'))) *
+           86400;
+  }
+
+  /**
+   * @brief Convert seconds since 1970 to the broken-down time.
+   * @param sec Seconds since 1970 (UTC)
+   * @param tm Result (tm_isdst is 0)
+   */
+  static void toTm(int64_t sec, std::tm& tm) {
+    int64_t days = sec / 86400;
+    int64_t rest = sec % 86400;
+    if (rest < 0) {
+      rest += 86400;
+      days--;
+    }
+    tm.tm_hour = static_cast<int>(rest / 3600);
+    tm.tm_min = static_cast<int>(rest % 3600 / 60);
+    tm.tm_sec = static_cast<int>(rest % 60);
+    // 1970-01-01 was a Thursday
+    tm.tm_wday = static_cast<int>((days % 7 + 11) % 7);
+    // civil from days
+    int64_t z = days + 719468;
+    int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    uint32_t doe = static_cast<uint32_t>(z - era * 146097);
+    uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    uint32_t mp = (5 * doy + 2) / 153;
+    uint32_t d = doy - (153 * mp + 2) / 5 + 1;
+    uint32_t m = mp < 10 ? mp + 3 : mp - 9;
+    int32_t y = static_cast<int32_t>(yoe + era * 400 + (m <= 2 ? 1 : 0));
+    tm.tm_year = y - 1900;
+    tm.tm_mon = static_cast<int>(m) - 1;
+    tm.tm_mday = static_cast<int>(d);
+    tm.tm_yday = static_cast<int>(days - daysFromCivil(y, 1, 1));
+    tm.tm_isdst = 0;
+  }
+
+ protected:
+  static constexpr uint32_t monthOf(const char* m) {
+    return m[0] == 'J'   ? (m[1] == 'a' ? 1 : m[2] == 'n' ? 6 : 7)
+           : m[0] == 'F' ? 2
+           : m[0] == 'M' ? (m[2] == 'r' ? 3 : 5)
+           : m[0] == 'A' ? (m[1] == 'p' ? 4 : 8)
+           : m[0] == 'S' ? 9
+           : m[0] == 'O' ? 10
+           : m[0] == 'N' ? 11
+                         : 12;
+  }
+  static constexpr int32_t eraOf(int32_t y) {
+    return (y >= 0 ? y : y - 399) / 400;
+  }
+  static constexpr uint32_t dayOfYear(uint32_t m, uint32_t d) {
+    return (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  }
+  static constexpr uint32_t dayOfEra(uint32_t yoe, uint32_t m, uint32_t d) {
+    return yoe * 365 + yoe / 4 - yoe / 100 + dayOfYear(m, d);
+  }
+  static constexpr int32_t daysFromCivilShifted(int32_t y, uint32_t m,
+                                                uint32_t d) {
+    return eraOf(y) * 146097 +
+           static_cast<int32_t>(dayOfEra(
+               static_cast<uint32_t>(y - eraOf(y) * 400), m, d)) -
+           719468;
+  }
+};
+
+#if NTP_TIMEZONE
+/**
+ * @brief Time zone with daylight saving time defined by a POSIX TZ string
+ * (e.g. "CET-1CEST,M3.5.0,M10.5.0/3"). The string is parsed once into
+ * transition rules; the offset is cached until the next transition, so
+ * offsetUs() is a range check on the hot path.
+ */
+class NTPTimeZone {
+ public:
+  /**
+   * @brief Parse a POSIX TZ string: std offset [dst [offset] [,start[/time],
+   * end[/time]]] with the dates Mm.w.d, Jn or n. Without rules the US rules
+   * are used.
+   * @return true if the string is valid.
+   */
+  bool begin(const char* tz) {
+    *this = NTPTimeZone();
+    const char* p = tz;
+    if (p == nullptr || !skipName(p)) return false;
+    int32_t offset;
+    if (!parseTime(p, offset)) return false;
+    _stdOffset = -offset;  // POSIX: positive west of Greenwich
+    _dstOffset = _stdOffset;
+    if (*p != 0) {
+      if (!skipName(p)) return false;
+      _dstOffset = _stdOffset + 3600;
+      if (*p != 0 && *p != ',') {
+        if (!parseTime(p, offset)) return false;
+        _dstOffset = -offset;
+      }
+      if (*p != 0 && *p != ',') return false;
+      const char* rules = *p == ',' ? p : ",M3.2.0,M11.1.0";
+      if (!parseRule(rules, _start) || !parseRule(rules, _end) ||
+          *rules != 0) {
+        return false;
+      }
+      _hasDst = true;
+    }
+    _active = true;
+    return true;
+  }
+
+  /**  @brief A valid time zone is defined. */
+  bool isActive() const { return _active; }
+
+  /**
+   * @brief Offset to UTC in seconds (east positive) at the indicated time.
+   * @param utcUs UTC microseconds since 1970.
+   */
+  int32_t offsetAt(uint64_t utcUs) {
+    if (utcUs < _fromUs || utcUs >= _untilUs) update(utcUs);
+    return _offset;
+  }
+
+  /**  @brief Daylight saving time is active at the indicated time. */
+  bool isDstAt(uint64_t utcUs) {
+    if (utcUs < _fromUs || utcUs >= _untilUs) update(utcUs);
+    return _dst;
+  }
+
+ protected:
+  /**  @brief Transition rule: Mm.w.d (month), Jn or n (day of year). */
+  struct Rule {
+    int32_t timeSec = 7200;  ///< local time of the transition
+    uint16_t day = 0;        ///< Jn: 1-365 without Feb 29, n: 0-365
+    uint8_t type = 0;        ///< 'M', 'J' or 'n'
+    uint8_t month = 0;
+    uint8_t week = 0;  ///< 1-5 (5: last)
+    uint8_t wday = 0;  ///< 0 = Sunday
+  };
+  uint64_t _fromUs = 0;
+  uint64_t _untilUs = 0;
+  Rule _start;
+  Rule _end;
+  int32_t _stdOffset = 0;
+  int32_t _dstOffset = 0;
+  int32_t _offset = 0;
+  bool _hasDst = false;
+  bool _dst = false;
+  bool _active = false;
+
+  static bool skipName(const char*& p) {
+    const char* start = p;
+    if (*p == '<') {
+      while (*p != 0 && *p != '>') p++;
+      if (*p != '>') return false;
+      p++;
+      return p - start > 2;
+    }
+    while ((*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z')) p++;
+    return p - start >= 3;
+  }
+
+  static bool parseNumber(const char*& p, int32_t& value) {
+    if (*p < '0' || *p > '9') return false;
+    value = 0;
+    while (*p >= '0' && *p <= '9') value = value * 10 + (*p++ - '0');
+    return true;
+  }
+
+  /**  @brief [+|-]hh[:mm[:ss]] in seconds. */
+  static bool parseTime(const char*& p, int32_t& sec) {
+    int32_t sign = 1;
+    if (*p == '+' || *p == '-') sign = *p++ == '-' ? -1 : 1;
+    int32_t value;
+    if (!parseNumber(p, value)) return false;
+    sec = value * 3600;
+    for (int32_t unit = 60; unit > 0 && *p == ':'; unit /= 60) {
+      p++;
+      if (!parseNumber(p, value)) return false;
+      sec += value * unit;
+    }
+    sec *= sign;
+    return true;
+  }
+
+  static bool parseRule(const char*& p, Rule& rule) {
+    if (*p++ != ',') return false;
+    int32_t value;
+    if (*p == 'M') {
+      p++;
+      rule.type = 'M';
+      if (!parseNumber(p, value) || value < 1 || value > 12) return false;
+      rule.month = static_cast<uint8_t>(value);
+      if (*p++ != '.' || !parseNumber(p, value) || value < 1 || value > 5)
+        return false;
+      rule.week = static_cast<uint8_t>(value);
+      if (*p++ != '.' || !parseNumber(p, value) || value > 6) return false;
+      rule.wday = static_cast<uint8_t>(value);
+    } else {
+      rule.type = 'n';
+      if (*p == 'J') {
+        p++;
+        rule.type = 'J';
+      }
+      if (!parseNumber(p, value) || value > 365) return false;
+      if (rule.type == 'J' && value < 1) return false;
+      rule.day = static_cast<uint16_t>(value);
+    }
+    if (*p == '/') {
+      p++;
+      if (!parseTime(p, rule.timeSec)) return false;
+    }
+    return true;
+  }
+
+  static bool isLeap(int32_t y) {
+    return (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+  }
+
+  /**  @brief Local seconds since 1970 of the transition in the year. */
+  static int64_t transition(const Rule& rule, int32_t y) {
+    int32_t days;
+    if (rule.type == 'M') {
+      days = NTPCalendar::daysFromCivil(y, rule.month, 1);
+      int32_t wday = ((days % 7) + 11) % 7;  // 1970-01-01 was a Thursday
+      int32_t mday = 1 + (rule.wday - wday + 7) % 7 + (rule.week - 1) * 7;
+      int32_t length =
+          rule.month == 12
+              ? 31
+              : NTPCalendar::daysFromCivil(y, rule.month + 1, 1) - days;
+      while (mday > length) mday -= 7;  // week 5: last in month
+      days += mday - 1;
+    } else {
+      days = NTPCalendar::daysFromCivil(y, 1, 1) + rule.day;
+      if (rule.type == 'J') days += (isLeap(y) && rule.day >= 60) ? 0 : -1;
+    }
+    return static_cast<int64_t>(days) * 86400 + rule.timeSec;
+  }
+
+  /**  @brief Determine the offset and its validity range. */
+  void update(uint64_t utcUs) {
+    _offset = _stdOffset;
+    _dst = false;
+    _fromUs = 0;
+    _untilUs = UINT64_MAX;
+    if (!_hasDst) return;
+    int64_t utc = static_cast<int64_t>(utcUs / 1000000ULL);
+    std::tm tm;
+    NTPCalendar::toTm(utc + _stdOffset, tm);
+    int64_t from = INT64_MIN, until = INT64_MAX;
+    // transitions of the previous, current and next year
+    for (int32_t y = tm.tm_year + 1899; y <= tm.tm_year + 1901; y++) {
+      int64_t toDst = transition(_start, y) - _stdOffset;
+      int64_t toStd = transition(_end, y) - _dstOffset;
+      if (toDst <= utc && toDst > from) {
+        from = toDst;
+        _dst = true;
+      }
+      if (toStd <= utc && toStd > from) {
+        from = toStd;
+        _dst = false;
+      }
+      if (toDst > utc && toDst < until) until = toDst;
+      if (toStd > utc && toStd < until) until = toStd;
+    }
+    _offset = _dst ? _dstOffset : _stdOffset;
+    _fromUs = from > 0 ? static_cast<uint64_t>(from) * 1000000ULL : 0;
+    _untilUs = static_cast<uint64_t>(until) * 1000000ULL;
+  }
+};
+#endif
+
+/**
+ * @brief Snapshot of the time base of a TinyNTPClient: the UTC time at a
+ * local tick and the estimated drift. It converts local ticks to UTC without
+ * accessing the client, so it can be copied to other tasks.
+ */
+struct NTPTimeBase {
+  uint64_t timeUs = 0;    ///< UTC microseconds since 1970 at tickUs
+  uint64_t tickUs = 0;    ///< Local tick (microseconds) of the last update
+  int32_t driftPpb = 0;   ///< Frequency error of the local clock (ppb)
+  int32_t offsetSec = 0;  ///< Time offset in seconds (timezone)
+#if NTP_LEAP
+  /// UTC microseconds (before the leap) at which the leap correction starts
+  uint64_t leapStartUs = UINT64_MAX;
+  uint32_t leapSmearMs = 0;  ///< Duration of the correction (0: step)
+  int8_t leap = 0;           ///< +1: inserted second, -1: deleted second
+#endif
+  bool valid = false;     ///< The time has been initialized by an update
+
+  /** @brief Elapsed local microseconds corrected by the drift. */
+  int64_t correctedUs(int64_t elapsedUs) const {
+    return elapsedUs + elapsedUs * driftPpb / 1000000000LL;
+  }
+
+  /** @brief UTC microseconds without a scheduled leap correction. */
+  uint64_t uncorrectedUs(uint64_t tick) const {
+    return timeUs + correctedUs(static_cast<int64_t>(tick - tickUs));
+  }
+
+  /** @brief UTC microseconds since 1970 (without offset) at a local tick. */
+  uint64_t utcUs(uint64_t tick) const {
+    uint64_t result = uncorrectedUs(tick);
+#if NTP_LEAP
+    // a single comparison outside of the correction window
+    if (result >= leapStartUs) result -= leapCorrectionUs(result);
+#endif
+    return result;
+  }
+
+#if NTP_LEAP
+  /**
+   * @brief Correction of the UTC time (before the leap) by a scheduled leap
+   * second: the whole second after the start of a step, a linear part of
+   * it during a smear.
+   */
+  int64_t leapCorrectionUs(uint64_t utcUs) const {
+    if (utcUs < leapStartUs) return 0;
+    int64_t full = leap * 1000000LL;
+    uint64_t elapsedUs = utcUs - leapStartUs;
+    uint64_t smearUs = leapSmearMs * 1000ULL;
+    if (elapsedUs >= smearUs) return full;
+    return full * static_cast<int64_t>(elapsedUs) /
+           static_cast<int64_t>(smearUs);
+  }
+#endif
+
+  /** @brief Microseconds since 1970 including the offset (0 if not valid). */
+  uint64_t timeUsAt(uint64_t tick) const {
+    if (!valid) return 0;
+    return utcUs(tick) + static_cast<int64_t>(offsetSec) * 1000000LL;
+  }
+};
+
+/**
+ * @brief Precomputed conversion of local ticks to the time (incl. offset)
+ * for timestamping many samples: one multiply per sample and no access to
+ * the client or the clock. The 32-bit ticks are the low bits of the clock,
+ * e.g. micros() captures; they must be within ~35 minutes of the snapshot.
+ */
+class NTPTimeSnapshot {
+ public:
+  NTPTimeSnapshot() = default;
+
+  /**  @brief Snapshot of the time base at the local tick. */
+  NTPTimeSnapshot(const NTPTimeBase& base, uint64_t tick) {
+    _valid = base.valid;
+    if (!_valid) return;
+    _tick = static_cast<uint32_t>(tick);
+    _timeUs = base.timeUsAt(tick);
+    // drift as 32.32 fixed point factor
+    _rate = static_cast<int64_t>(base.driftPpb) * 4294967296LL / 1000000000LL;
+  }
+
+  /**  @brief Time in microseconds since 1970 of a local tick (0 if invalid). */
+  uint64_t toUs(uint32_t tick) const {
+    return _valid ? convert(tick) : 0;
+  }
+
+  /**
+   * @brief Convert an array of local ticks to microseconds since 1970.
+   * @param ticks Local ticks (e.g. micros() captures).
+   * @param out Result: n values (0 if the time is not valid).
+   * @param n Number of ticks.
+   */
+  void toUs(const uint32_t* ticks, uint64_t* out, size_t n) const {
+    if (!_valid) {
+      for (size_t j = 0; j < n; j++) out[j] = 0;
+      return;
+    }
+    for (size_t j = 0; j < n; j++) out[j] = convert(ticks[j]);
+  }
+
+  /**  @brief Convert an array of local ticks to milliseconds since 1970. */
+  void toMs(const uint32_t* ticks, uint64_t* out, size_t n) const {
+    toUs(ticks, out, n);
+    for (size_t j = 0; j < n; j++) out[j] /= 1000ULL;
+  }
+
+  /**  @brief The time has been initialized. */
+  operator bool() const { return _valid; }
+
+ protected:
+  uint64_t _timeUs = 0;
+  int64_t _rate = 0;
+  uint32_t _tick = 0;
+  bool _valid = false;
+
+  uint64_t convert(uint32_t tick) const {
+    int64_t elapsed = static_cast<int32_t>(tick - _tick);
+    return _timeUs + elapsed + ((elapsed * _rate) >> 32);
+  }
+};
+
+/**
+ * @brief Default clock policy: a wraparound-safe 64-bit monotonic microsecond
+ * tick based on millis(), refined with micros(). The 32-bit millis() wrap
+ * (~49.7 days) is detected on each call, so the clock must be read at least
+ * once in that period (e.g. by loop() or needsUpdate()). The result never
+ * goes backwards, even if millis() and micros() are read on both sides of
+ * a millisecond edge.
+ */
+class NTPArduinoClock {
+ public:
+  /**  @brief Microseconds since startup. */
+  uint64_t nowUs() {
+    uint32_t ms = ::millis();
+    uint32_t us = ::micros();
+    if (ms < _lastMs) _msHigh++;  // millis() wrapped
+    _lastMs = ms;
+    uint64_t ms64 = (static_cast<uint64_t>(_msHigh) << 32) | ms;
+    // sub millisecond part from micros(): ignore it if both are not in sync
+    uint32_t sub = us - ms * 1000UL;
+    if (sub >= 1000) sub = 0;
+    uint64_t result = ms64 * 1000ULL + sub;
+    if (result < _lastUs) return _lastUs;
+    _lastUs = result;
+    return result;
+  }
+
+ protected:
+  uint64_t _lastUs = 0;
+  uint32_t _lastMs = 0;
+  uint32_t _msHigh = 0;
+};
+
+#ifdef ESP32
+#include "esp_timer.h"
+/**
+ * @brief Clock policy for the ESP32: the 64-bit esp_timer does not wrap.
+ */
+class NTPESP32Clock {
+ public:
+  /**  @brief Microseconds since startup. */
+  uint64_t nowUs() const {
+    return static_cast<uint64_t>(esp_timer_get_time());
+  }
+};
+#endif
+
 /**
  * @class TinyNTPClient
  * @brief A Network Time Protocol (NTP) client for retrieving the current
@@ -20,8 +833,12 @@
  * calculation. The timezone offset can be set to account for local time
  * differences.
  * @tparam UDPAPI The UDP class to use (e.g: WiFiUDP)
+ * @tparam MAX_SERVERS Maximum number of servers which are queried together
+ * @tparam CLOCK Monotonic clock policy providing uint64_t nowUs() (e.g.
+ * NTPArduinoClock)
  */
-template <typename UDPAPI>
+template <typename UDPAPI, int MAX_SERVERS = NTP_MAX_SERVERS,
+          typename CLOCK = NTPArduinoClock>
 class TinyNTPClient {
  public:
   /**
@@ -31,7 +848,9 @@ class TinyNTPClient {
    */
   TinyNTPClient(const char* server = "pool.ntp.org", int port = 123,
                 uint32_t timeoutMs = 6000)
-      : _server(server), _port(port), _timeoutMs(timeoutMs) {}
+      : _timeoutMs(timeoutMs), _port(port) {
+    _servers[0] = server;
+  }
 
   /**
    * @brief Initialize the NTP client and perform the first time update.
@@ -47,9 +866,18 @@ class TinyNTPClient {
    */
   void end() {
     _timeOffsetSeconds = 0;
-    _lastNtpTime = 0;
-    _lastUpdateMillis = 0;
+#if NTP_TIMEZONE
+    _tz = NTPTimeZone();
+#endif
+    _base = NTPTimeBase();
+    _restored = false;
+    _state = NTPState::IDLE;
     _udp.stop();
+    _bound = false;
+#if NTP_BROADCAST
+    _broadcast = false;
+    _broadcastDelayUs = -1;
+#endif
   }
 
   /**
@@ -65,72 +893,650 @@ class TinyNTPClient {
    * @brief Get the current time in milliseconds since Unix epoch (UTC).
    * @return Current time in milliseconds.
    */
-  uint64_t getTimeMs() {
-    if (_lastUpdateMillis == 0) {
-      return 0;  // Time not yet initialized
-    }
-    // Calculate ms since last update
-    uint32_t ms_since_update = ::millis() - _lastUpdateMillis;
-    // Return last NTP time in ms plus elapsed ms, plus offset
-    return (static_cast<uint64_t>(_lastNtpTime) * 1000ULL) +
-           static_cast<uint64_t>(ms_since_update) +
-           static_cast<uint64_t>(_timeOffsetSeconds) * 1000ULL;
+  uint64_t getTimeMs() { return getTimeUs() / 1000ULL; }
+
+  /**
+   * @brief Get the current time in microseconds since Unix epoch (UTC).
+   * @return Current time in microseconds.
+   */
+  uint64_t getTimeUs() {
+    if (!_base.valid) {
+      return 0;  // Time not yet initialized
+    }
+    uint64_t utc = utcTimeUs();
+    // Return UTC time plus offset
+    return utc + static_cast<uint64_t>(offsetAt(utc)) * 1000000ULL;
+  }
+
+  /**
+   * @brief Alias for getTimeMs().
+   * @return Current time in milliseconds.
+   */
+  uint64_t millis() { return getTimeMs(); }
+
+  /**
+   * @brief Get the current time as a std::tm structure (UTC). The result is
+   * cached (NTP_TM_CACHE): within the same day only the time fields are
+   * advanced, the date is only recalculated at the day boundary or after a
+   * resync.
+   * @return std::tm structure representing the current time (UTC).
+   */
+  std::tm getTm() {
+    uint32_t sec = getTimeSec();
+#if NTP_TM_CACHE
+    int64_t delta = static_cast<int64_t>(sec) - _tmSec;
+    int64_t daySec = _tm.tm_hour * 3600L + _tm.tm_min * 60L + _tm.tm_sec;
+    if (_tmValid && delta >= 0 && daySec + delta < 86400) {
+      if (delta > 0) {
+        daySec += delta;
+        _tm.tm_hour = static_cast<int>(daySec / 3600);
+        _tm.tm_min = static_cast<int>(daySec % 3600 / 60);
+        _tm.tm_sec = static_cast<int>(daySec % 60);
+      }
+    } else {
+      NTPCalendar::toTm(sec, _tm);
+      _tmValid = true;
+    }
+    _tmSec = sec;
+    return _tm;
+#else
+    std::tm result;
+    NTPCalendar::toTm(sec, result);
+    return result;
+#endif
+  }
+
+  /**
+   * @brief Set the time offset in seconds (e.g., for timezone adjustment).
+   * @param offset Time offset in seconds.
+   */
+  void setTimeOffsetSeconds(long offset) {
+#if NTP_TIMEZONE
+    _tz = NTPTimeZone();
+#endif
+    _timeOffsetSeconds = static_cast<int32_t>(offset);
+  }
+
+  /**
+   * @brief Set the time offset in hours (e.g., for timezone adjustment).
+   * @param hours Time offset in hours.
+   */
+  void setTimeOffsetHours(long hours) { setTimeOffsetSeconds(hours * 3600); }
+
+#if NTP_TIMEZONE
+  /**
+   * @brief Define the time zone with a POSIX TZ string (e.g.
+   * "CET-1CEST,M3.5.0,M10.5.0/3" or "EST5EDT,M3.2.0,M11.1.0"): replaces the
+   * time offset and switches between standard and daylight saving time.
+   * @return true if the string is valid; otherwise the time zone and the
+   * time offset are cleared (UTC).
+   */
+  bool setTimeZone(const char* tz) {
+    bool result = _tz.begin(tz);
+    if (!result) {
+      _tz = NTPTimeZone();
+      _timeOffsetSeconds = 0;
+    }
+    return result;
+  }
+
+  /**
+   * @brief Get the current local time as std::tm (see getTm()) with
+   * tm_isdst of the time zone defined with setTimeZone().
+   */
+  std::tm getLocalTm() {
+    std::tm result = getTm();
+    result.tm_isdst =
+        _tz.isActive() && _base.valid && _tz.isDstAt(utcTimeUs()) ? 1 : 0;
+    return result;
+  }
+#endif
+
+  /**
+   * @brief Set the NTP server address and port. This replaces all servers
+   * which were defined with addServer().
+   * @param server NTP server hostname or IP address.
+   * @param port NTP server port (default: 123).
+   */
+  void setServer(const char* server, int port = 123) {
+    _servers[0] = server;
+    _serverCount = 1;
+    _port = port;
+#if NTP_DNS_CACHE
+    _addresses[0] = NTPAddressCache();
+#endif
+  }
+
+  /**
+   * @brief Add an additional NTP server: all servers are queried in one burst
+   * and the time is selected from the combined responses.
+   * @param server NTP server hostname or IP address.
+   * @return false if MAX_SERVERS servers are already defined.
+   */
+  bool addServer(const char* server) {
+    if (_serverCount >= MAX_SERVERS) return false;
+#if NTP_DNS_CACHE
+    _addresses[_serverCount] = NTPAddressCache();
+#endif
+    _servers[_serverCount++] = server;
+    return true;
+  }
+
+#if NTP_DNS_CACHE
+  /**
+   * @brief Set the NTP server by address (no DNS lookup). This replaces all
+   * servers which were defined with addServer().
+   */
+  void setServer(IPAddress address, int port = 123) {
+    setServer(static_cast<const char*>(nullptr), port);
+    _addresses[0].ip[0] = address;
+    _addresses[0].count = 1;
+    _addresses[0].fixed = true;
+  }
+
+  /**  @brief Add an additional NTP server by address (no DNS lookup). */
+  bool addServer(IPAddress address) {
+    if (!addServer(static_cast<const char*>(nullptr))) return false;
+    NTPAddressCache& cache = _addresses[_serverCount - 1];
+    cache.ip[0] = address;
+    cache.count = 1;
+    cache.fixed = true;
+    return true;
+  }
+
+  /**
+   * @brief Resolve the host names with the indicated function and cache the
+   * addresses (instead of a lookup by the UDP API for each request). The
+   * addresses are resolved again after NTP_DNS_TTL_MS and dropped when they
+   * do not answer. Successive lookups of a pool which return different
+   * addresses are collected (up to NTP_DNS_ADDRESSES) and used in turn.
+   * Example: setResolver([](const char* host, IPAddress& ip) {
+   * return WiFi.hostByName(host, ip) == 1; });
+   */
+  void setResolver(NTPResolver resolver) {
+    _resolver = resolver;
+    clearDnsCache();
+  }
+
+  /**  @brief Drop the resolved addresses: they are resolved again. */
+  void clearDnsCache() {
+    for (int i = 0; i < _serverCount; i++) {
+      if (!_addresses[i].fixed) _addresses[i] = NTPAddressCache();
+    }
+  }
+#endif
+
+  /**
+   * @brief Define the local UDP port (default: NTP_LOCAL_PORT, 0 =
+   * ephemeral port selected by the network stack). The socket is bound once
+   * with the first update and reused until end().
+   */
+  void setLocalPort(uint16_t port) {
+    if (port != _localPort && _bound) {
+      _udp.stop();
+      _bound = false;
+    }
+    _localPort = port;
+  }
+
+  /**  @brief Number of defined NTP servers. */
+  int getServerCount() const { return _serverCount; }
+
+  /**
+   * @brief Update the current time from the NTP server.
+   * @return true if the update was successful, false otherwise.
+   */
+  bool update() { return ntpExchange(1); }
+
+  /**
+   * @brief Update the current time with a burst of requests to each server:
+   * the requests are sent back-to-back and the sample with the lowest
+   * round-trip delay is used (NTP clock filter). getSampleJitterUs() reports
+   * the jitter of the samples.
+   * @param n Number of requests per server (limited by NTP_MAX_REQUESTS).
+   * @return true if the update was successful, false otherwise.
+   */
+  bool updateBurst(int n) { return ntpExchange(n); }
+
+  /**
+   * @brief Start a non-blocking update: sends the request and returns
+   * immediately. Call poll() until it no longer returns NTPState::SENT.
+   * @param burst Number of requests per server (see updateBurst()).
+   * @return true if the request was sent, false otherwise.
+   */
+  bool startUpdate(int burst = 1) { return sendRequest(burst); }
+
+  /**
+   * @brief Advance the non-blocking update without waiting.
+   * @return NTPState::SENT while waiting for the response; the result
+   * (RECEIVED, TIMEOUT or FAILED) is reported once, then NTPState::IDLE.
+   */
+  NTPState poll() {
+    if (_state != NTPState::SENT) return NTPState::IDLE;
+    int packetSize;
+    while ((packetSize = _udp.parsePacket()) > 0) {
+      if (!receiveResponse(packetSize)) _stats.rejectedCount++;
+    }
+    if (_receivedCount < _requestCount) {
+      uint64_t now = _clock.nowUs();
+      bool budget = now - _timeoutStartUs <=
+                    static_cast<uint64_t>(_timeoutMs) * 1000ULL;
+      // the attempts are sent at multiples of the attempt timeout
+      bool attempt = now - _timeoutStartUs <=
+                     static_cast<uint64_t>(getAttemptTimeoutMs()) * 1000ULL *
+                         _attempt;
+      if (budget && attempt) return _state;
+      if (budget && _attempt < _maxAttempts && retransmit()) return _state;
+    }
+    _stats.exchangeUs = static_cast<uint32_t>(_clock.nowUs() - _timeoutStartUs);
+    if (_validCount == 0) {
+#if NTP_DNS_CACHE
+      evictAddresses();
+#endif
+      // unauthenticated responses are not matched: report them anyway
+      if (_receivedCount == 0 &&
+          _rejectError != NTPError::AUTHENTICATION) {
+        log<NTP_LOG_ERROR>("NTP: request timed out");
+        finish(NTPState::TIMEOUT, NTPError::TIMEOUT);
+      } else {
+        log<NTP_LOG_ERROR>("NTP: no valid response");
+        finish(NTPState::FAILED, _rejectError);
+      }
+      return _state;
+    }
+    int64_t offsetUs;
+    if (!selectOffset(offsetUs)) {
+#if NTP_DNS_CACHE
+      evictAddresses();
+#endif
+      log<NTP_LOG_ERROR>("NTP: no majority of the servers agrees");
+      finish(NTPState::FAILED, NTPError::NO_MAJORITY);
+      return _state;
+    }
+    applyOffset(offsetUs);
+#if NTP_LEAP
+    scheduleLeap(_peerLeap);
+#endif
+#if NTP_DNS_CACHE
+    evictAddresses();  // after selectOffset() which uses the indexes
+#endif
+#if NTP_BROADCAST
+    // calibration of the listen-only mode: half of the round trip
+    if (_broadcast) {
+      _broadcastDelayUs = _stats.delayUs / 2;
+      _broadcastTickUs = _base.tickUs;
+      _broadcastOffsetUs = 0;
+    }
+#endif
+    finish(NTPState::RECEIVED, NTPError::NONE);
+    return _state;
+  }
+
+  /**
+   * @brief Check if the next scheduled update is due: the poll interval
+   * adapts to the measured offset and jitter and backs off on failures.
+   * @return true if startUpdate() should be called.
+   */
+  bool needsUpdate() {
+    if (_state == NTPState::SENT) return false;
+    if (!_scheduled) return true;  // never updated
+    return _clock.nowUs() - _scheduleTickUs >=
+           static_cast<uint64_t>(getPollIntervalMs()) * 1000ULL;
+  }
+
+  /**
+   * @brief Keep the time up to date without blocking: call this method in
+   * the Arduino loop(). It starts the update when needsUpdate() and
+   * processes the response.
+   * @return the state as reported by poll().
+   */
+  NTPState loop() {
+    if (_state == NTPState::SENT) return poll();
+#if NTP_BROADCAST
+    if (_broadcast && _broadcastDelayUs >= 0) return listen();
+#endif
+    if (needsUpdate() && !startUpdate()) return NTPState::FAILED;
+    return _state == NTPState::SENT ? poll() : NTPState::IDLE;
+  }
+
+#if NTP_BROADCAST
+  /**
+   * @brief Start the listen-only mode: the client receives the broadcasts
+   * (mode 5) of a server on the indicated port and only sends requests for
+   * the calibration of the path delay. This performs the calibration
+   * exchange with the defined server(s), which should be the broadcast
+   * server. Then call loop() (or listen()).
+   * @param port Local port of the broadcasts (default: 123)
+   * @return true if the calibration was successful.
+   */
+  bool beginBroadcast(uint16_t port = 123) {
+    end();
+    setLocalPort(port);
+    _broadcast = true;
+    return update();
+  }
+
+  /**
+   * @brief Start the listen-only mode with multicast packets: the UDP API
+   * must provide beginMulticast() (e.g. WiFiUDP). See beginBroadcast().
+   * @param group Multicast address (e.g. 224.0.1.1)
+   * @param port Local port of the broadcasts (default: 123)
+   * @return true if the calibration was successful.
+   */
+  bool beginMulticast(IPAddress group, uint16_t port = 123) {
+    end();
+    _localPort = port;
+    _broadcast = true;
+    _bound = _udp.beginMulticast(group, port) != 0;
+    if (!_bound) {
+      log<NTP_LOG_ERROR>("NTP: could not join multicast group");
+      finish(NTPState::FAILED, NTPError::SOCKET);
+      return false;
+    }
+    return update();
+  }
+
+  /**
+   * @brief Process the received broadcasts without sending any request
+   * (listen-only mode): each broadcast corrects the time by the offset of
+   * its transmit timestamp plus the calibrated one-way delay.
+   * @return NTPState::RECEIVED if the time was corrected, otherwise IDLE.
+   */
+  NTPState listen() {
+    NTPState result = NTPState::IDLE;
+    int packetSize;
+    while ((packetSize = _udp.parsePacket()) > 0) {
+      if (receiveBroadcast(packetSize)) {
+        result = NTPState::RECEIVED;
+      } else {
+        _stats.rejectedCount++;
+      }
+    }
+    return result;
+  }
+
+  /**  @brief The listen-only mode is active and calibrated. */
+  bool isBroadcast() const { return _broadcast && _broadcastDelayUs >= 0; }
+
+  /**  @brief Calibrated one-way delay of the broadcasts (-1: none). */
+  int32_t getBroadcastDelayUs() const { return _broadcastDelayUs; }
+
+  /**
+   * @brief Define the one-way delay of the broadcasts instead of the
+   * calibration (or -1 to calibrate again with the next loop()).
+   */
+  void setBroadcastDelayUs(int32_t delayUs) { _broadcastDelayUs = delayUs; }
+#endif
+
+  /**
+   * @brief Interval until the next update in milliseconds: 2^poll seconds
+   * after a success, an exponential backoff after failures.
+   */
+  uint32_t getPollIntervalMs() const {
+    if (_failures > 0) {
+      uint8_t exp = NTP_RETRY_POLL + _failures - 1;
+      // a rate limited server must not be asked faster than the poll interval
+      if (_rateLimited && exp < _pollExp) exp = _pollExp;
+      if (exp > NTP_MAX_POLL) exp = NTP_MAX_POLL;
+      return 1000UL << exp;
+    }
+    return 1000UL << _pollExp;
+  }
+
+  /**  @brief Current poll exponent (log2 seconds). */
+  uint8_t getPollExponent() const { return _pollExp; }
+
+  /**  @brief Estimated jitter of the offset in microseconds. */
+  int32_t getJitterUs() const { return _stats.jitterUs; }
+
+  /**  @brief Stratum of the selected server (0 = unknown). */
+  uint8_t getStratum() const { return _stats.stratum; }
+
+  /**
+   * @brief Leap indicator of the local time as sent by TinyNTPServer: 1
+   * (insert) or 2 (delete) while an announced leap second is pending and
+   * stepped, 3 if the time is not synchronized, otherwise 0.
+   */
+  uint8_t getLeapIndicator() {
+    if (!_base.valid) return 3;
+#if NTP_LEAP
+    if (_base.leap != 0 && _base.leapSmearMs == 0 &&
+        _base.uncorrectedUs(_clock.nowUs()) < _base.leapStartUs) {
+      return _base.leap > 0 ? 1 : 2;
+    }
+#endif
+    return 0;
+  }
+
+#if NTP_LEAP
+  /**
+   * @brief Smear the announced leap seconds linearly over the indicated
+   * time centered on the leap (e.g. 86400000 as the public smearing
+   * servers), so that the time never jumps. 0 (default, NTP_LEAP_SMEAR_MS):
+   * the last second of the day is repeated or skipped.
+   */
+  void setLeapSmear(uint32_t durationMs) { _leapSmearMs = durationMs; }
+#endif
+
+  /**
+   * @brief Jitter (RMS of the offset differences to the selected sample) of
+   * the samples of the selected server in the last update: 0 without burst.
+   */
+  int32_t getSampleJitterUs() const { return _sampleJitterUs; }
+
+  /**  @brief Offset in microseconds corrected by the last update. */
+  int64_t getOffsetUs() const { return _stats.offsetUs; }
+
+  /**  @brief Round-trip delay in microseconds measured by the last update. */
+  int32_t getDelayUs() const { return _stats.delayUs; }
+
+  /**
+   * @brief Statistics of the updates (delays, offset, jitter, counters and
+   * the result of the last update), e.g. for telemetry.
+   */
+  const NTPStats& getStats() const { return _stats; }
+
+  /**  @brief Reset the counters and the minimum delay of the statistics. */
+  void resetStats() {
+    _stats.minDelayUs = 0;
+    _stats.successCount = 0;
+    _stats.timeoutCount = 0;
+    _stats.failureCount = 0;
+    _stats.rejectedCount = 0;
+    _stats.retryCount = 0;
+  }
+
+  /**
+   * @brief Define the total time budget of an update in milliseconds
+   * (default: timeoutMs of the constructor).
+   */
+  void setTimeout(uint32_t timeoutMs) { _timeoutMs = timeoutMs; }
+
+  /**
+   * @brief Define the retry policy: the requests which are not answered
+   * within the attempt timeout are sent again, up to maxAttempts times within
+   * the total budget (setTimeout()). Servers which answered one of their
+   * requests are not asked again: the round finishes as soon as every server
+   * has answered or used up its attempts.
+   * @param maxAttempts Number of attempts (1: no retransmission).
+   * @param attemptTimeoutMs Timeout of an attempt in milliseconds.
+   * @param adaptive Use NTP_RTT_FACTOR times the smoothed round-trip time
+   * (at least NTP_MIN_ATTEMPT_TIMEOUT_MS, at most attemptTimeoutMs) once it
+   * has been measured, i.e. from the first response on.
+   */
+  void setRetry(uint8_t maxAttempts, uint32_t attemptTimeoutMs,
+                bool adaptive = true) {
+    _maxAttempts = maxAttempts < 1 ? 1 : maxAttempts;
+    _attemptTimeoutMs = attemptTimeoutMs;
+    _adaptiveTimeout = adaptive;
+  }
+
+  /**  @brief Timeout of the next attempt in milliseconds. */
+  uint32_t getAttemptTimeoutMs() const {
+    if (!_adaptiveTimeout || _srttUs == 0) return _attemptTimeoutMs;
+    uint32_t result = static_cast<uint32_t>(
+        (static_cast<uint64_t>(_srttUs) * NTP_RTT_FACTOR + 999) / 1000);
+    if (result < NTP_MIN_ATTEMPT_TIMEOUT_MS) {
+      result = NTP_MIN_ATTEMPT_TIMEOUT_MS;
+    }
+    return result < _attemptTimeoutMs ? result : _attemptTimeoutMs;
+  }
+
+  /**  @brief Smoothed round-trip time in microseconds (0: not measured). */
+  uint32_t getSmoothedRttUs() const { return _srttUs; }
+
+  /**
+   * @brief Estimated frequency error of the local clock in parts per billion
+   * (positive: the local clock is running slow). It is learned from the
+   * offsets of consecutive updates and applied by getTimeMs().
+   */
+  int32_t getDriftPpb() const { return _base.driftPpb; }
+
+  /**  @brief Define the frequency error e.g. from a previous run. */
+  void setDriftPpb(int32_t ppb) { _base.driftPpb = ppb; }
+
+  /**
+   * @brief Snapshot of the time base (incl. the time offset of the time
+   * zone at the current time): converts local ticks of the clock to the
+   * time without calling the client.
+   */
+  NTPTimeBase getTimeBase() {
+    NTPTimeBase result = _base;
+    result.offsetSec = _base.valid ? offsetAt(utcTimeUs()) : _timeOffsetSeconds;
+    return result;
   }
 
   /**
-   * @brief Alias for getTimeMs().
-   * @return Current time in milliseconds.
+   * @brief Precomputed conversion of local ticks (e.g. micros() captures) to
+   * the time for batch timestamping: see NTPTimeSnapshot.
    */
-  uint64_t millis() { return getTimeMs(); }
+  NTPTimeSnapshot getSnapshot() {
+    return NTPTimeSnapshot(getTimeBase(), _clock.nowUs());
+  }
 
   /**
-   * @brief Get the current time as a std::tm structure (UTC).
-   * @return std::tm structure representing the current time (UTC).
+   * @brief Save the synchronization state, e.g. before a deep sleep: time,
+   * drift, poll interval, round-trip time and the last server.
+   * @param state Destination (e.g. a RTC_DATA_ATTR variable or a NVS blob)
+   * @param rtcUs Microseconds of a timer which keeps running during the
+   * sleep (e.g. the RTC): the same timer must be passed to restoreState().
+   * @return false if the time is not valid.
    */
-  std::tm getTm() {
-    time_t t = getTimeSec();
-    std::tm tm_result;
-    gmtime_r(&t, &tm_result);
-    return tm_result;
+  bool saveState(NTPSyncState& state, uint64_t rtcUs) {
+    if (!_base.valid) return false;
+    uint64_t tick = _clock.nowUs();
+    uint64_t age = _scheduled ? (tick - _scheduleTickUs) / 1000ULL : 0;
+    state = NTPSyncState();
+    state.timeUs = _base.utcUs(tick);
+    state.rtcUs = rtcUs;
+    state.ageMs = static_cast<uint32_t>(age < UINT32_MAX ? age : UINT32_MAX);
+    state.srttUs = _srttUs;
+    state.driftPpb = _base.driftPpb;
+    state.offsetSec = offsetAt(state.timeUs);
+    state.pollExp = _pollExp;
+    state.stratum = _stats.stratum;
+#if NTP_DNS_CACHE
+    state.server = _peerServer;
+    for (int j = 0; j < 4; j++) state.address[j] = _peerAddress[j];
+#endif
+    state.magic = NTP_STATE_MAGIC;
+    state.checksum = state.computeChecksum();
+    return true;
   }
 
   /**
-   * @brief Set the time offset in seconds (e.g., for timezone adjustment).
-   * @param offset Time offset in seconds.
+   * @brief Restore the state saved with saveState() (instead of begin()):
+   * the time continues by the elapsed sleep timer and the next update is
+   * scheduled when the poll interval since the last update has elapsed, so
+   * loop() does not use the network before. The sleep timer is not
+   * corrected by the drift of the local clock: the first update only corrects
+   * the time and keeps the restored drift.
+   * @param state Saved state
+   * @param rtcUs Current value of the sleep timer
+   * @return false if the state is invalid or the timer has been reset.
    */
-  void setTimeOffsetSeconds(long offset) { _timeOffsetSeconds = offset; }
+  bool restoreState(const NTPSyncState& state, uint64_t rtcUs) {
+    if (!state.isValid() || rtcUs < state.rtcUs) return false;
+    uint64_t elapsed = rtcUs - state.rtcUs;
+    uint64_t tick = _clock.nowUs();
+    _base.timeUs = state.timeUs + elapsed;
+    _base.tickUs = tick;
+    _base.driftPpb = state.driftPpb;
+    _base.valid = true;
+    _restored = true;
+    _timeOffsetSeconds = state.offsetSec;
+    _srttUs = state.srttUs;
+    _stats.stratum = state.stratum;
+    _pollExp = state.pollExp;
+    if (_pollExp < NTP_MIN_POLL) _pollExp = NTP_MIN_POLL;
+    if (_pollExp > NTP_MAX_POLL) _pollExp = NTP_MAX_POLL;
+    // the clock has restarted: the tick of the last update may be negative
+    _scheduleTickUs = tick - (state.ageMs * 1000ULL + elapsed);
+    _scheduled = true;
+    _failures = 0;
+    _state = NTPState::IDLE;
+#if NTP_DNS_CACHE
+    // use the last server again without resolving its name
+    IPAddress address(state.address[0], state.address[1], state.address[2],
+                      state.address[3]);
+    if (state.server < _serverCount && !(address == IPAddress()) &&
+        !_addresses[state.server].fixed) {
+      NTPAddressCache& cache = _addresses[state.server];
+      cache = NTPAddressCache();
+      cache.ip[0] = address;
+      cache.count = 1;
+      cache.resolvedUs = tick;
+      cache.growing = false;
+      _peerServer = state.server;
+      _peerAddress = address;
+    }
+#endif
+    return true;
+  }
+
+  /**  @brief Get the state of the current or last update. */
+  NTPState getState() const { return _state; }
 
+  /**  @brief Conversion operator to bool. */
+  operator bool() const { return _base.valid; }
+
+#if NTP_LOG_LEVEL > NTP_LOG_NONE
   /**
-   * @brief Set the time offset in hours (e.g., for timezone adjustment).
-   * @param hours Time offset in hours.
+   * @brief Define the output for the log messages (e.g. Serial): by default
+   * nothing is logged. Use NTP_LOG_LEVEL to select the messages at compile
+   * time (NTP_LOG_NONE removes the logger).
    */
-  void setTimeOffsetHours(long hours) { _timeOffsetSeconds = hours * 3600; }
+  void setLogger(Print& out) { _logger = &out; }
+#endif
 
+#if NTP_AUTH
   /**
-   * @brief Set the NTP server address and port.
-   * @param server NTP server hostname or IP address.
-   * @param port NTP server port (default: 123).
+   * @brief Authenticate the requests and responses with a symmetric key
+   * (RFC 5905 MAC with AES-128-CMAC, RFC 8573): responses without a valid
+   * MAC are rejected. The key must stay valid while it is used.
    */
-  void setServer(const char* server, int port = 123) {
-    _server = server;
-    _port = port;
-  }
+  void setKey(const NTPSymmetricKey& key) { _key = &key; }
+
+  /**  @brief Stop the authentication. */
+  void clearKey() { _key = nullptr; }
+#endif
 
+#if NTP_REQUEST_TAG
   /**
-   * @brief Update the current time from the NTP server.
-   * @return true if the update was successful, false otherwise.
+   * @brief Add a tag to the transmit timestamps (in units of 2^-32 s), so
+   * that clients which share a socket never send the same timestamp (see
+   * TinyNTPClientManager). Tags below 4096 change T1 by less than 1 us.
    */
-  bool update() {
-    return (_lastUpdateMillis == 0) ? updateWithoutRTC() && updateWithRTC()
-                                    : updateWithRTC();
-  }
-
-  /**  @brief Conversion operator to bool. */
-  operator bool() const { return _lastUpdateMillis != 0; }
+  void setRequestTag(uint32_t tag) { _requestTag = tag; }
+#endif
 
   /**  @brief Get a reference to the UDP API. */
   UDPAPI& getUDP() { return _udp; }
 
+  /**  @brief Get a reference to the monotonic clock. */
+  CLOCK& getClock() { return _clock; }
+  const CLOCK& getClock() const { return _clock; }
+
  protected:
   /**
    * @brief Structure representing an NTP packet (RFC 5905, 48 bytes)
@@ -159,31 +1565,198 @@ class TinyNTPClient {
         0;  // Transmit timestamp (seconds) - time reply sent by server
     uint32_t txTm_f = 0;  // Transmit timestamp (fraction)
   };
+  static_assert(sizeof(NTPPacket) == 48, "NTP packet must be 48 bytes");
+
+  /**
+   * @brief A request sent to one server in the current burst.
+   */
+  struct NTPRequest {
+    uint64_t txTm = 0;       // Transmit timestamp sent to the server (T1)
+    int64_t offsetUs = 0;    // Measured offset of the local clock
+    int32_t delayUs = 0;     // Measured round-trip delay
+    int32_t distanceUs = 0;  // Root distance: maximum error of the offset
+    uint8_t stratum = 0;     // Stratum of the server
+    uint8_t poll = 0;        // Poll exponent requested by the server
+    bool sent = false;       // The request was sent successfully
+    int32_t jitterUs = 0;    // Jitter of the samples of the server
+    uint8_t server = 0;      // Index of the server
+    bool received = false;   // A matching response was received
+    bool valid = false;      // The response is a valid sample
+    bool best = false;       // Sample with the lowest delay of the server
+    uint8_t address = 0xFF;  // Index of the cached address (0xFF: none)
+#if NTP_TX_TIMESTAMPS
+    int32_t txDelayUs = 0;   // Departure (driver timestamp) after txTm
+#endif
+#if NTP_LEAP
+    uint8_t leap = 0;        // Leap indicator of the response
+#endif
+  };
+
+#if NTP_DNS_CACHE
+  /**
+   * @brief Resolved addresses of a server.
+   */
+  static_assert(NTP_DNS_ADDRESSES <= 8, "NTP_DNS_ADDRESSES must be <= 8");
+  struct NTPAddressCache {
+    IPAddress ip[NTP_DNS_ADDRESSES];
+    uint64_t resolvedUs = 0;  // Local tick of the last resolution
+    uint8_t count = 0;        // Number of valid addresses
+    uint8_t next = 0;         // Next address to use
+    bool growing = true;      // Resolve again to find more addresses
+    bool fixed = false;       // Address defined by setServer(IPAddress)
+    bool queried = false;     // The resolver was called in this round
+  };
+#endif
+
+  // Members are ordered by size to avoid padding
 
   /** Reference to the UDP API (e.g., WiFiUDP, EthernetUDP). */
   UDPAPI _udp;
-  /** NTP server hostname or IP address. */
-  const char* _server;
-  /** NTP server port. */
-  int _port;
+  /** Monotonic clock */
+  CLOCK _clock;
+  /** Maximum number of requests in flight (at least one per server). */
+  static constexpr int MAX_REQUESTS =
+      NTP_MAX_REQUESTS > MAX_SERVERS ? NTP_MAX_REQUESTS : MAX_SERVERS;
+  /** Requests of the current burst: burst size per server. */
+  NTPRequest _requests[MAX_REQUESTS];
+#if NTP_DNS_CACHE
+  /** Resolved addresses of the servers. */
+  NTPAddressCache _addresses[MAX_SERVERS];
+  /** Function which resolves the host names (nullptr: UDP API). */
+  NTPResolver _resolver = nullptr;
+  /** Address of the system peer of the last update (empty: unknown). */
+  IPAddress _peerAddress;
+#endif
+  /** Time base: UTC time at the local tick of the last update and drift. */
+  NTPTimeBase _base;
+  /** Local tick (microseconds) when the last update has finished. */
+  uint64_t _scheduleTickUs = 0;
+  /** Local tick (microseconds) when the pending request was sent. */
+  uint64_t _timeoutStartUs = 0;
+#if NTP_BROADCAST
+  /** Local tick of the last frequency estimate in the listen-only mode. */
+  uint64_t _broadcastTickUs = 0;
+  /** Offsets of the broadcasts since _broadcastTickUs. */
+  int64_t _broadcastOffsetUs = 0;
+#endif
+  /** Statistics of the updates. */
+  NTPStats _stats;
+  /** NTP server hostnames or IP addresses. */
+  const char* _servers[MAX_SERVERS] = {};
+#if NTP_LOG_LEVEL > NTP_LOG_NONE
+  /** Output for log messages (nullptr: no logging). */
+  Print* _logger = nullptr;
+#endif
+#if NTP_AUTH
+  /** Key for the authentication (nullptr: none). */
+  const NTPSymmetricKey* _key = nullptr;
+#endif
+#if NTP_TIMEZONE
+  /** Time zone rules defined with setTimeZone(). */
+  NTPTimeZone _tz;
+#endif
+#if NTP_TM_CACHE
+  /** Cached result of getTm(). */
+  std::tm _tm = {};
+  /** Seconds since 1970 represented by _tm. */
+  uint32_t _tmSec = 0;
+#endif
+#if NTP_TINY
+  /** Packet buffer shared by the request and the response. */
+  NTPPacket _packet;
+#endif
+  /** Jitter of the samples of the last exchange (microseconds). */
+  int32_t _sampleJitterUs = 0;
   /** Time offset in seconds (for timezone adjustment). */
-  long _timeOffsetSeconds = 0;
-  /** Last received NTP time (seconds since Unix epoch). */
-  uint32_t _lastNtpTime = 0;
-  /** Milliseconds when the last NTP update was received. */
-  uint32_t _lastUpdateMillis = 0;
+  int32_t _timeOffsetSeconds = 0;
   /** Timeout for NTP response in milliseconds. */
   uint32_t _timeoutMs = 0;
+  /** Timeout of an attempt in milliseconds. */
+  uint32_t _attemptTimeoutMs = NTP_ATTEMPT_TIMEOUT_MS;
+  /** Smoothed round-trip time in microseconds (0: not measured). */
+  uint32_t _srttUs = 0;
+#if NTP_REQUEST_TAG
+  /** Added to the transmit timestamps (see setRequestTag()). */
+  uint32_t _requestTag = 0;
+#endif
+#if NTP_LEAP
+  /** Duration of the leap second smear in ms (0: step). */
+  uint32_t _leapSmearMs = NTP_LEAP_SMEAR_MS;
+#endif
+#if NTP_BROADCAST
+  /** One-way delay of the broadcasts in microseconds (-1: uncalibrated). */
+  int32_t _broadcastDelayUs = -1;
+#endif
+  /** NTP server port. */
+  uint16_t _port;
+  /** Local UDP port (0 = ephemeral). */
+  uint16_t _localPort = NTP_LOCAL_PORT;
+  /** Number of defined servers. */
+  uint8_t _serverCount = 1;
+  /** Number of used request slots in the current burst. */
+  uint8_t _slotCount = 0;
+  /** Number of requests sent in the current burst. */
+  uint8_t _requestCount = 0;
+  /** Number of matching responses received in the current burst. */
+  uint8_t _receivedCount = 0;
+  /** Number of valid samples received in the current burst. */
+  uint8_t _validCount = 0;
+  /** Poll exponent: the update interval is 2^_pollExp seconds. */
+  uint8_t _pollExp = NTP_MIN_POLL;
+  /** Number of consecutive stable updates. */
+  uint8_t _pollCount = 0;
+  /** Number of consecutive failed updates. */
+  uint8_t _failures = 0;
+  /** Poll exponent requested by the servers. */
+  uint8_t _serverPoll = 0;
+  /** Maximum number of attempts of an update. */
+  uint8_t _maxAttempts = NTP_MAX_ATTEMPTS;
+  /** Current attempt of the update (1 = first). */
+  uint8_t _attempt = 0;
+#if NTP_DNS_CACHE
+  /** Server index of the system peer of the last update. */
+  uint8_t _peerServer = 0;
+#endif
+#if NTP_LEAP
+  /** Leap indicator of the system peer of the last update. */
+  uint8_t _peerLeap = 0;
+#endif
+  /** State of the current update. */
+  NTPState _state = NTPState::IDLE;
+  /** Error reported if no valid response is received. */
+  NTPError _rejectError = NTPError::INVALID_RESPONSE;
+  /** The time was not yet initialized when the requests were sent. */
+  bool _coldStart = false;
+  /** The time base was restored: the next offset is the sleep timer error. */
+  bool _restored = false;
+  /** An update has finished: _scheduleTickUs is valid. */
+  bool _scheduled = false;
+  /** The local UDP port is bound. */
+  bool _bound = false;
+  /** A server has sent a kiss-o'-death RATE. */
+  bool _rateLimited = false;
+  /** Derive the attempt timeout from the smoothed round-trip time. */
+  bool _adaptiveTimeout = true;
+#if NTP_BROADCAST
+  /** Listen-only mode: the time is received with broadcasts. */
+  bool _broadcast = false;
+#endif
+#if NTP_TM_CACHE
+  /** _tm is valid. */
+  bool _tmValid = false;
+#endif
 
-  constexpr bool isLittleEndian() {
-    unsigned int x = 1;
-    char* c = (char*)&x;
-    return (int)*c;
-  }
+  /** @brief Byte order of the target (compile time: NTP_BIG_ENDIAN). */
+  static constexpr bool isLittleEndian() { return !NTP_BIG_ENDIAN; }
 
-  inline uint32_t swap32(uint32_t value) {
+  /** @brief Reverse the byte order (compiler intrinsic if available). */
+  static constexpr uint32_t swap32(uint32_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_bswap32(value);
+#else
     return ((value & 0x000000FF) << 24) | ((value & 0x0000FF00) << 8) |
            ((value & 0x00FF0000) >> 8) | ((value & 0xFF000000) >> 24);
+#endif
   }
 
   /**
@@ -192,7 +1765,7 @@ class TinyNTPClient {
    * @param hostlong Value in host byte order.
    * @return Value in network byte order.
    */
-  inline uint32_t l_htonl(uint32_t hostlong) {
+  static constexpr uint32_t l_htonl(uint32_t hostlong) {
     return isLittleEndian() ? swap32(hostlong) : hostlong;
   }
 
@@ -202,52 +1775,359 @@ class TinyNTPClient {
    * @param netlong Value in network byte order.
    * @return Value in host byte order.
    */
-  inline uint32_t l_ntohl(uint32_t netlong) {
+  static constexpr uint32_t l_ntohl(uint32_t netlong) {
     return isLittleEndian() ? swap32(netlong) : netlong;
   }
 
+  /** @brief Current UTC time (without offset) in microseconds since 1970. */
+  uint64_t utcTimeUs() { return _base.utcUs(_clock.nowUs()); }
+
+  /**
+   * @brief Time offset in seconds at the indicated UTC time: the offset of
+   * the time zone if one is defined.
+   */
+  int32_t offsetAt(uint64_t utcUs) {
+#if NTP_TIMEZONE
+    if (_tz.isActive()) _timeOffsetSeconds = _tz.offsetAt(utcUs);
+#else
+    (void)utcUs;
+#endif
+    return _timeOffsetSeconds;
+  }
+
+  /** @brief Current UTC time as NTP timestamp (32.32 fixed point, 1900). */
+  uint64_t currentNtpTime() { return toNtpTime(utcTimeUs()); }
+
+  /**
+   * @brief Transmit timestamp of a request: the slot (and the tag) in the
+   * lowest bits make the timestamps of a burst unique.
+   */
+  uint64_t transmitTime(int slot) {
+#if NTP_REQUEST_TAG
+    return currentNtpTime() + slot + _requestTag;
+#else
+    return currentNtpTime() + slot;
+#endif
+  }
+
+  /**
+   * @brief Combine the NTP seconds and fraction fields (in network byte order)
+   * to a 64-bit NTP timestamp (32.32 fixed point).
+   */
+  uint64_t ntpTime(uint32_t sec, uint32_t frac) {
+    return (static_cast<uint64_t>(l_ntohl(sec)) << 32) | l_ntohl(frac);
+  }
+
+  /**
+   * @brief Convert microseconds since 1970 to an NTP timestamp (32.32): the
+   * seconds wrap at the end of an era (2036) as in the packets, the
+   * differences of timestamps stay valid across the rollover.
+   */
+  static uint64_t toNtpTime(uint64_t unixUs) {
+    uint64_t sec = unixUs / 1000000ULL + 2208988800ULL;
+    uint64_t frac = ((unixUs % 1000000ULL) << 32) / 1000000ULL;
+    return (sec << 32) | frac;
+  }
+
+  /** @brief Convert an NTP timestamp (32.32) to microseconds since 1970. */
+  static uint64_t toUnixUs(uint64_t ntp) {
+    uint64_t sec = (ntp >> 32) - 2208988800ULL;
+    uint64_t frac = ((ntp & 0xFFFFFFFFULL) * 1000000ULL) >> 32;
+    return sec * 1000000ULL + frac;
+  }
+
+  /**
+   * @brief Convert an NTP timestamp (32.32) to microseconds since 1970 in
+   * the NTP era which is closest to the pivot (within 68 years).
+   */
+  static uint64_t toUnixUs(uint64_t ntp, uint64_t pivotUs) {
+    uint64_t pivot = pivotUs / 1000000ULL + 2208988800ULL;  // incl. era
+    int32_t diff = static_cast<int32_t>(static_cast<uint32_t>(ntp >> 32) -
+                                        static_cast<uint32_t>(pivot));
+    uint64_t sec = pivot + diff - 2208988800ULL;
+    uint64_t frac = ((ntp & 0xFFFFFFFFULL) * 1000000ULL) >> 32;
+    return sec * 1000000ULL + frac;
+  }
+
+  /** @brief Convert an NTP short format value (16.16) to microseconds. */
+  static int64_t toUsShort(uint32_t ntpShort) {
+    return (static_cast<int64_t>(ntpShort) * 1000000LL) >> 16;
+  }
+
+  /** @brief Convert a signed NTP time difference (32.32) to microseconds. */
+  static int64_t toUs(int64_t ntpDiff) {
+    return (ntpDiff / (1LL << 32)) * 1000000LL +
+           ((ntpDiff % (1LL << 32)) * 1000000LL) / (1LL << 32);
+  }
+
   /**
    * @brief Perform the NTP request/response exchange and update the internal
-   * time.
-   *
-   * @param txTm_s   Transmit timestamp (seconds since NTP epoch, 1900) to send
-   * in the request packet.
+   * time. Blocks until the response was received or the timeout expired.
+   * @param burst Number of requests per server.
    * @return true if the update was successful, false otherwise.
    */
-  bool ntpExchange(uint32_t txTm_s) {
-    NTPPacket packet = {};
-    // Set LI=3 (no warning), VN=3 (NTPv3), Mode=3 (client)
-    // Binary: 11 011 011 = 0xDB
-    packet.li_vn_mode = 0xDB;
-    // Convert transmit timestamp to network byte order
-    packet.txTm_s = l_htonl(txTm_s);
-    packet.txTm_f = 0;
-
-    _udp.begin(_port);
-    _udp.beginPacket(_server, _port);
-    _udp.write(reinterpret_cast<uint8_t*>(&packet), sizeof(NTPPacket));
-    _udp.endPacket();
+  bool ntpExchange(int burst) {
+    if (!sendRequest(burst)) return false;
+    while (poll() == NTPState::SENT);
+    return getState() == NTPState::RECEIVED;
+  }
 
-    // Wait for response with timeout
-    uint32_t timeout_ms = ::millis() + _timeoutMs;
-    int packetSize = 0;
-    while ((packetSize = _udp.parsePacket()) == 0) {
-      if (::millis() > timeout_ms) {
-        log("NTP: request timed out\n");
+  /**
+   * @brief Send the NTP request to all servers in one burst without waiting
+   * for the responses.
+   * @param burst Number of requests per server.
+   * @return true if at least one request was sent, false otherwise.
+   */
+  bool sendRequest(int burst) {
+    _coldStart = !_base.valid;
+    _requestCount = 0;
+    _receivedCount = 0;
+    _validCount = 0;
+    // The socket is bound only once and reused for all updates
+    if (!_bound) {
+      if (!_udp.begin(_localPort)) {
+        log<NTP_LOG_ERROR>("NTP: could not bind local port ", _localPort);
+        finish(NTPState::FAILED, NTPError::SOCKET);
         return false;
       }
+      _bound = true;
+    }
+    // Drop late responses of a previous round
+    for (int i = 0; i < NTP_MAX_DRAIN && _udp.parsePacket() > 0; i++);
+    if (burst * _serverCount > MAX_REQUESTS) {
+      burst = MAX_REQUESTS / _serverCount;
+    }
+    if (burst < 1) burst = 1;
+#if NTP_DNS_CACHE
+    // each host is resolved at most once per round
+    for (int i = 0; i < _serverCount; i++) _addresses[i].queried = false;
+#endif
+    _slotCount = 0;
+    for (int j = 0; j < burst; j++) {
+      for (int i = 0; i < _serverCount; i++) {
+        NTPRequest& request = _requests[_slotCount];
+        request = NTPRequest();
+        request.server = i;
+        // The transmit timestamp identifies the response: keep it unique
+        request.txTm = transmitTime(_slotCount);
+        request.sent = sendTo(request);
+        if (request.sent) _requestCount++;
+        _slotCount++;
+      }
+    }
+    if (_requestCount == 0) {
+      finish(NTPState::FAILED, NTPError::SEND);
+      return false;
+    }
+    _timeoutStartUs = _clock.nowUs();
+    _attempt = 1;
+    _rejectError = NTPError::INVALID_RESPONSE;
+    _state = NTPState::SENT;
+    return true;
+  }
+
+  /**
+   * @brief Send the unanswered requests again with new transmit timestamps:
+   * late responses to the previous attempt are ignored. Servers which have
+   * answered already are not asked again.
+   * @return false if there was nothing to send: the round is complete.
+   */
+  bool retransmit() {
+    bool sent = false;
+    for (int i = 0; i < _slotCount; i++) {
+      NTPRequest& request = _requests[i];
+      if (!request.sent || request.received || answered(request.server)) {
+        continue;
+      }
+      if (!sent) {
+        log<NTP_LOG_INFO>("NTP: retransmitting - attempt ", _attempt + 1);
+        sent = true;
+      }
+      request.txTm = transmitTime(i);
+      if (!sendTo(request)) {
+        request.sent = false;
+        _requestCount--;
+      }
+    }
+    if (!sent) return false;
+    _attempt++;
+    _stats.retryCount++;
+    return true;
+  }
+
+  /**  @brief true if the server answered one of the requests of the round */
+  bool answered(uint8_t server) const {
+    for (int i = 0; i < _slotCount; i++) {
+      if (_requests[i].server == server && _requests[i].received) return true;
+    }
+    return false;
+  }
+
+  /**
+   * @brief Send the request to its server: to a cached address if available.
+   */
+  bool sendTo(NTPRequest& request) {
+    bool result;
+#if NTP_DNS_CACHE
+    IPAddress address;
+    if (lookup(request.server, address, request.address)) {
+      result = sendPacket(address, request.txTm);
+    } else if (_servers[request.server] == nullptr) {
+      return false;
+    } else
+#endif
+    {
+      result = sendPacket(_servers[request.server], request.txTm);
+    }
+#if NTP_TX_TIMESTAMPS
+    // the driver reports the departure: T1 without the send latency
+    uint32_t age;
+    request.txDelayUs = 0;
+    if (result && NTPTimestampTraits<UDPAPI>::getTxAgeUs(_udp, age)) {
+      int64_t sent =
+          toUs(static_cast<int64_t>(currentNtpTime() - request.txTm));
+      if (sent > age) request.txDelayUs = static_cast<int32_t>(sent - age);
+    }
+#endif
+    return result;
+  }
+
+  /**
+   * @brief Local receive time of the current packet as NTP timestamp: the
+   * driver timestamp if available, otherwise now.
+   */
+  uint64_t receiveTime() {
+    uint64_t result = currentNtpTime();
+    uint32_t age;
+    if (NTPTimestampTraits<UDPAPI>::getRxAgeUs(_udp, age)) {
+      result -= (static_cast<uint64_t>(age) << 32) / 1000000ULL;
+    }
+    return result;
+  }
+
+#if NTP_DNS_CACHE
+  /**
+   * @brief Determine the address of a server from the cache: resolves the
+   * host when the cache is empty or expired and while a pool returns new
+   * addresses, but only once per round (the other requests of the burst
+   * and the retransmissions use the result).
+   * @param server Index of the server.
+   * @param address Result.
+   * @param index Index of the address in the cache (0xFF: fixed address).
+   * @return false if no address is available.
+   */
+  bool lookup(uint8_t server, IPAddress& address, uint8_t& index) {
+    NTPAddressCache& cache = _addresses[server];
+    if (cache.fixed) {
+      address = cache.ip[0];
+      return true;
+    }
+    const char* host = _servers[server];
+    if (_resolver == nullptr || host == nullptr) return false;
+    uint64_t now = _clock.nowUs();
+    bool expired = cache.count == 0 ||
+                   now - cache.resolvedUs > NTP_DNS_TTL_MS * 1000ULL;
+    if ((expired || cache.growing) && !cache.queried) {
+      cache.queried = true;
+      IPAddress found;
+      if (_resolver(host, found)) {
+        if (expired) {
+          cache.count = 0;
+          cache.next = 0;
+          cache.resolvedUs = now;
+        }
+        bool known = false;
+        for (int j = 0; j < cache.count; j++) {
+          if (cache.ip[j] == found) known = true;
+        }
+        if (!known) cache.ip[cache.count++] = found;
+        cache.growing = !known && cache.count < NTP_DNS_ADDRESSES;
+      } else {
+        log<NTP_LOG_WARNING>("NTP: could not resolve server ", host);
+        cache.growing = false;
+      }
+    }
+    if (cache.count == 0) return false;
+    // rotate through the addresses of the server
+    index = cache.next % cache.count;
+    cache.next = index + 1;
+    address = cache.ip[index];
+    return true;
+  }
+
+  /**
+   * @brief Drop the cached addresses which have not answered the current
+   * burst: the host is resolved again when all addresses failed.
+   */
+  void evictAddresses() {
+    uint8_t failed[MAX_SERVERS] = {};
+    for (int i = 0; i < _slotCount; i++) {
+      const NTPRequest& r = _requests[i];
+      if (r.sent && !r.received && r.address != 0xFF) {
+        failed[r.server] |= 1 << r.address;
+      }
+    }
+    for (int i = 0; i < _serverCount; i++) {
+      if (failed[i] == 0) continue;
+      NTPAddressCache& cache = _addresses[i];
+      uint8_t count = 0;
+      for (int j = 0; j < cache.count; j++) {
+        if (!(failed[i] & (1 << j))) cache.ip[count++] = cache.ip[j];
+      }
+      cache.count = count;
+      cache.growing = count < NTP_DNS_ADDRESSES;
+    }
+  }
+#endif
+
+  /**
+   * @brief Send a single NTP request packet.
+   * @param server NTP server hostname or IP address.
+   * @param txTm   Transmit timestamp (NTP 32.32 since 1900) to send in the
+   * request packet.
+   * @return true if the request was sent, false otherwise.
+   */
+  template <typename ADDRESS>
+  bool sendPacket(ADDRESS server, uint64_t txTm) {
+    // Request template: all fields 0 except the header, only the transmit
+    // timestamp is set per request
+#if NTP_TINY
+    NTPPacket& packet = _packet;
+    packet = NTPPacket();
+#else
+    NTPPacket packet;
+#endif
+    packet.li_vn_mode = NTP_CLIENT_HEADER;
+    // Convert transmit timestamp to network byte order
+    packet.txTm_s = l_htonl(static_cast<uint32_t>(txTm >> 32));
+    packet.txTm_f = l_htonl(static_cast<uint32_t>(txTm));
+
+    if (!_udp.beginPacket(server, _port)) {
+      log<NTP_LOG_ERROR>("NTP: could not resolve server ", server);
+      return false;
     }
+    _udp.write(reinterpret_cast<uint8_t*>(&packet), sizeof(NTPPacket));
+#if NTP_AUTH
+    if (_key != nullptr) _key->write(_udp, reinterpret_cast<uint8_t*>(&packet));
+#endif
+    _udp.endPacket();
+    return true;
+  }
 
-    // Read response
-    uint32_t t3_millis = ::millis();
-    NTPPacket response = {};
-    uint8_t* buffer = reinterpret_cast<uint8_t*>(&response);
+  /**
+   * @brief Read a packet of at least 48 bytes.
+   * @param packetSize Size of the received packet as reported by parsePacket().
+   * @param packet Buffer for the packet.
+   * @return true if the whole packet was read, false otherwise.
+   */
+  bool readPacket(int packetSize, NTPPacket& packet) {
+    uint8_t* buffer = reinterpret_cast<uint8_t*>(&packet);
 
     // Check if packet size is correct
     if (packetSize < (int)sizeof(NTPPacket)) {
       _udp.read(buffer, packetSize);  // Read available data for logging
-      log("NTP: packet too short - Expected: %d, Got: %d (%s)\n",
-          sizeof(NTPPacket), packetSize, buffer);
+      log<NTP_LOG_WARNING>("NTP: packet too short - Expected: ",
+                           (int)sizeof(NTPPacket), ", Got: ", packetSize);
       return false;
     }
 
@@ -265,74 +2145,586 @@ class TinyNTPClient {
     }
 
     if (totalRead < (int)sizeof(NTPPacket)) {
-      log("NTP: response read incomplete - Expected: %d, Got: %d (%s)\n",
-          sizeof(NTPPacket), totalRead, buffer);
+      log<NTP_LOG_WARNING>("NTP: response read incomplete - Expected: ",
+                           (int)sizeof(NTPPacket), ", Got: ", totalRead);
+      return false;
+    }
+    return true;
+  }
+
+#if NTP_AUTH
+  /**
+   * @brief Check the MAC of a received packet if a key is defined.
+   * @return true if no key is defined or the MAC is valid.
+   */
+  bool authenticate(int packetSize, const NTPPacket& packet) {
+    if (_key == nullptr) return true;
+    if (_key->verify(_udp, reinterpret_cast<const uint8_t*>(&packet),
+                     packetSize)) {
+      return true;
+    }
+    log<NTP_LOG_WARNING>("NTP: packet ignored - authentication failed");
+    _rejectError = NTPError::AUTHENTICATION;
+    _stats.error = NTPError::AUTHENTICATION;
+    return false;
+  }
+#endif
+
+  /**
+   * @brief Read an NTP response and record the offset and delay for the
+   * request with the matching originate timestamp.
+   * @param packetSize Size of the received packet as reported by parsePacket().
+   * @return true if the response was valid, false otherwise.
+   */
+  bool receiveResponse(int packetSize) {
+    // Read response: local receive time
+    uint64_t t4 = receiveTime();  // T4
+#if NTP_TINY
+    NTPPacket& response = _packet;
+    response = NTPPacket();
+#else
+    NTPPacket response;
+#endif
+    if (!readPacket(packetSize, response)) return false;
+#if NTP_AUTH
+    // authenticate before the response is used in any way (incl. KoD)
+    if (!authenticate(packetSize, response)) return false;
+#endif
+
+    // Only accept server responses (mode 4) of a known version
+    uint8_t mode = response.li_vn_mode & 0x07;
+    uint8_t version = (response.li_vn_mode >> 3) & 0x07;
+    if (mode != 4 || version < 1 || version > 4) {
+      log<NTP_LOG_WARNING>("NTP: response ignored - invalid mode/version");
+      return false;
+    }
+
+    // Find the request which is answered by this response: this also
+    // protects against stale and spoofed responses
+    uint64_t originate = ntpTime(response.origTm_s, response.origTm_f);  // T1
+    NTPRequest* request = nullptr;
+    for (int i = 0; i < _slotCount; i++) {
+      if (_requests[i].sent && !_requests[i].received &&
+          _requests[i].txTm == originate) {
+        request = &_requests[i];
+        break;
+      }
+    }
+    if (request == nullptr) {
+      log<NTP_LOG_WARNING>("NTP: response ignored - no matching request");
       return false;
     }
 
-    bool useOffset = (txTm_s != 0);
-    if (useOffset) {
-      // Full NTP offset calculation
-      uint32_t originate = l_ntohl(response.origTm_s);
-      uint32_t receive = l_ntohl(response.rxTm_s);
-      uint32_t transmit = l_ntohl(response.txTm_s);
-      // log("NTP: originate=%u, receive=%u, transmit=%u\n", originate, receive,
-      // transmit);
-      uint32_t t3_unix = getTimeSec();
-      uint32_t t3_ntp = t3_unix + 2208988800UL;
-      long offset =
-          ((long)(receive - originate) + (long)(transmit - t3_ntp)) / 2;
-      _lastNtpTime = transmit - 2208988800UL + offset;
-      _lastUpdateMillis = t3_millis;
-      // log("NTP: _lastNtpTime=%u, _lastUpdateMillis=%u\n", _lastNtpTime,
-      // _lastUpdateMillis);
+    // The server has answered: don't wait for it any longer
+    request->received = true;
+    _receivedCount++;
+    request->stratum = response.stratum;
+    request->poll = response.poll;
+#if NTP_LEAP
+    request->leap = response.li_vn_mode >> 6;
+#endif
+
+    // Kiss-o'-Death: stratum 0 with an ASCII code in the reference id
+    if (response.stratum == 0) {
+      uint32_t code = l_ntohl(response.refId);
+      _rejectError = NTPError::KISS_OF_DEATH;
+      if (code == 0x52415445UL) {  // "RATE": reduce the poll rate
+        log<NTP_LOG_WARNING>("NTP: kiss-o'-death RATE - backing off");
+        _rateLimited = true;
+        if (_pollExp < NTP_MAX_POLL) _pollExp++;
+      } else {
+        log<NTP_LOG_ERROR>("NTP: kiss-o'-death received");
+      }
+      return false;
+    }
+
+    // T1 of the offset: the departure if the driver has reported it
+    uint64_t t1 = originate;
+#if NTP_TX_TIMESTAMPS
+    t1 += (static_cast<uint64_t>(request->txDelayUs) << 32) / 1000000ULL;
+#endif
+    uint64_t receive = ntpTime(response.rxTm_s, response.rxTm_f);   // T2
+    uint64_t transmit = ntpTime(response.txTm_s, response.txTm_f);  // T3
+    // Reject unsynchronized servers (LI = 3 or stratum 16) and empty times
+    if ((response.li_vn_mode >> 6) == 3 || response.stratum >= 16 ||
+        transmit == 0 || receive == 0) {
+      log<NTP_LOG_WARNING>("NTP: response ignored - server not synchronized");
+      _rejectError = NTPError::UNSYNCHRONIZED;
+      return false;
+    }
+
+    // Round-trip delay (RFC 5905) in 32.32 fixed point
+    int64_t delay = (int64_t)(t4 - t1) - (int64_t)(transmit - receive);
+    request->delayUs = static_cast<int32_t>(toUs(delay));
+    if (!_coldStart) {
+      // Full NTP offset calculation (RFC 5905) in 32.32 fixed point
+      int64_t offset = ((int64_t)(receive - t1) +
+                        (int64_t)(transmit - t4)) / 2;
+      request->offsetUs = toUs(offset);
     } else {
-      // Only use server transmit timestamp
-      uint32_t transmit = l_ntohl(response.txTm_s);
-      // log("NTP: raw transmit=%u (0x%08X), converted=%u\n", response.txTm_s,
-      // response.txTm_s, transmit);
-      _lastNtpTime = transmit - 2208988800UL;
-      _lastUpdateMillis = t3_millis;
-      // log("NTP: _lastNtpTime=%u, _lastUpdateMillis=%u, t3_millis=%u\n",
-      // _lastNtpTime, _lastUpdateMillis, t3_millis);
+      // Not initialized yet: T1 and T4 are the local time since startup, so
+      // the offset exceeds the 32.32 difference range: use microseconds
+      // T2 and T3 are placed in the era of the build date
+      uint64_t pivotUs = static_cast<uint64_t>(NTP_BUILD_TIME) * 1000000ULL;
+      int64_t t1us = toUnixUs(t1), t4us = toUnixUs(t4);
+      int64_t t2us = toUnixUs(receive, pivotUs);
+      int64_t t3us = toUnixUs(transmit, pivotUs);
+      request->offsetUs = ((t2us - t1us) + (t3us - t4us)) / 2;
+    }
+    // Root distance (RFC 5905): half of the total delay plus the dispersion
+    int64_t rootDelay = toUsShort(l_ntohl(response.rootDelay));
+    int64_t rootDispersion = toUsShort(l_ntohl(response.rootDispersion));
+    int64_t distance = (request->delayUs > 0 ? request->delayUs : 0);
+    distance =
+        (distance + rootDelay) / 2 + rootDispersion + NTP_MIN_DISPERSION_US;
+    request->distanceUs =
+        static_cast<int32_t>(distance < INT32_MAX ? distance : INT32_MAX);
+    request->valid = true;
+    _validCount++;
+    // first measurement: the unanswered requests of the round are retried
+    // after the adaptive attempt timeout instead of NTP_ATTEMPT_TIMEOUT_MS
+    if (_srttUs == 0 && request->delayUs > 0) {
+      _srttUs = static_cast<uint32_t>(request->delayUs);
     }
     return true;
   }
 
+#if NTP_BROADCAST
   /**
-   * @brief Request the current time from the NTP server and update the
-   * internal time.
-   * @return true if the update was successful, false otherwise.
+   * @brief Read a broadcast (mode 5) and correct the time: the offset is the
+   * transmit timestamp plus the calibrated one-way delay minus the local
+   * receive time. An offset above NTP_STEP_THRESHOLD_US is not applied but
+   * triggers a new calibration exchange, so a stray packet cannot step the
+   * clock.
+   * @param packetSize Size of the received packet as reported by parsePacket().
+   * @return true if the time was corrected, false otherwise.
    */
-  bool updateWithoutRTC() {
-    // No real time clock: set transmit timestamp to zero, use millis for
-    // timeout
-    return ntpExchange(0);
+  bool receiveBroadcast(int packetSize) {
+    uint64_t t4 = receiveTime();  // T4
+    NTPPacket packet;
+    if (!readPacket(packetSize, packet)) return false;
+#if NTP_AUTH
+    if (!authenticate(packetSize, packet)) return false;
+#endif
+    uint8_t mode = packet.li_vn_mode & 0x07;
+    uint8_t version = (packet.li_vn_mode >> 3) & 0x07;
+    if (mode != 5 || version < 1 || version > 4) {
+      log<NTP_LOG_WARNING>("NTP: broadcast ignored - invalid mode/version");
+      return false;
+    }
+    uint64_t transmit = ntpTime(packet.txTm_s, packet.txTm_f);  // T3
+    if ((packet.li_vn_mode >> 6) == 3 || packet.stratum == 0 ||
+        packet.stratum >= 16 || transmit == 0) {
+      log<NTP_LOG_WARNING>("NTP: broadcast ignored - server not synchronized");
+      _stats.error = NTPError::UNSYNCHRONIZED;
+      return false;
+    }
+    int64_t offsetUs =
+        toUs(static_cast<int64_t>(transmit - t4)) + _broadcastDelayUs;
+    int64_t leapUs = 0;
+#if NTP_LEAP
+    // the server steps at the leap: no recalibration
+    if (isLeapStep(_clock.nowUs())) return false;
+    leapUs = leapOffsetUs(_clock.nowUs());
+#endif
+    if (offsetUs + leapUs > NTP_STEP_THRESHOLD_US ||
+        offsetUs + leapUs < -NTP_STEP_THRESHOLD_US) {
+      log<NTP_LOG_WARNING>("NTP: broadcast offset too large - calibrating");
+      _stats.error = NTPError::INVALID_RESPONSE;
+      _broadcastDelayUs = -1;
+      _scheduled = false;  // loop() sends the calibration request now
+      return false;
+    }
+    // the broadcasts are more frequent than the minimum interval of the
+    // frequency estimate: accumulate the offsets until it has elapsed
+    uint64_t tick = _clock.nowUs();
+    _broadcastOffsetUs += offsetUs + leapUs;
+    if (tick - _broadcastTickUs >= NTP_MIN_DRIFT_INTERVAL_MS * 1000ULL) {
+      discipline(_broadcastOffsetUs, tick - _broadcastTickUs);
+      _broadcastTickUs = tick;
+      _broadcastOffsetUs = 0;
+    }
+    _stats.stratum = packet.stratum;
+    _serverPoll = 0;
+    applyOffset(offsetUs, false);
+#if NTP_LEAP
+    scheduleLeap(packet.li_vn_mode >> 6);
+#endif
+    finish(NTPState::RECEIVED, NTPError::NONE);
+    return true;
   }
+#endif
 
   /**
-   * @brief Request the current time from the NTP server and update the
-   * internal time using a real time clock.
-   * @return true if the update was successful, false otherwise.
+   * @brief Select the offset from the received responses (RFC 5905 clock
+   * select): find the Marzullo intersection of the correctness intervals
+   * [offset - distance, offset + distance] which are consistent with most
+   * servers and combine the survivors weighted by 1/distance. The round is
+   * rejected if the intersection does not cover more than half of the
+   * servers, so that a falseticker never moves the time.
+   * @param offsetUs Result: the selected offset in microseconds.
+   * @return false if no majority of the servers agrees.
+   */
+  bool selectOffset(int64_t& offsetUs) {
+    clockFilter();
+    struct Edge {
+      int64_t value;
+      int type;  // +1: interval start, -1: interval end
+    };
+    Edge edges[2 * MAX_SERVERS];
+    int edgeCount = 0;
+    for (int i = 0; i < _slotCount; i++) {
+      const NTPRequest& r = _requests[i];
+      if (!r.best) continue;
+      edges[edgeCount++] = {r.offsetUs - r.distanceUs, +1};
+      edges[edgeCount++] = {r.offsetUs + r.distanceUs, -1};
+    }
+    // Sort by value (insertion sort: we have only a few entries); at equal
+    // values the start comes first, so that touching intervals intersect
+    for (int i = 1; i < edgeCount; i++) {
+      Edge edge = edges[i];
+      int j = i - 1;
+      while (j >= 0 &&
+             (edges[j].value > edge.value ||
+              (edges[j].value == edge.value && edges[j].type < edge.type))) {
+        edges[j + 1] = edges[j];
+        j--;
+      }
+      edges[j + 1] = edge;
+    }
+    // Find the intersection which is covered by the most intervals
+    int count = 0, best = 0;
+    int64_t low = 0, high = 0;
+    for (int i = 0; i < edgeCount; i++) {
+      count += edges[i].type;
+      if (edges[i].type > 0 && count > best) {
+        best = count;
+        low = edges[i].value;
+        high = edges[i + 1].value;
+      }
+    }
+    if (best * 2 <= edgeCount / 2) {
+      _stats.rejectedCount += edgeCount / 2;
+      return false;
+    }
+    if (best < edgeCount / 2) {
+      log<NTP_LOG_INFO>("NTP: ", edgeCount / 2 - best, " of ", edgeCount / 2,
+                        " servers rejected");
+      _stats.rejectedCount += edgeCount / 2 - best;
+    }
+    // Combine the survivors: offsets relative to the first survivor
+    int64_t reference = 0, sum = 0, weightSum = 0, minDelay = 0;
+    int32_t minDistance = INT32_MAX;
+    bool first = true;
+    _stats.stratum = 0;
+    _serverPoll = 0;
+    for (int i = 0; i < _slotCount; i++) {
+      const NTPRequest& r = _requests[i];
+      if (!r.best) continue;
+      if (r.offsetUs - r.distanceUs > high || r.offsetUs + r.distanceUs < low)
+        continue;
+      if (first) {
+        reference = r.offsetUs;
+        minDelay = r.delayUs;
+        first = false;
+      }
+      int64_t weight = 1000000000LL / r.distanceUs;
+      if (weight < 1) weight = 1;
+      sum += (r.offsetUs - reference) * weight;
+      weightSum += weight;
+      if (r.delayUs < minDelay) minDelay = r.delayUs;
+      if (r.distanceUs < minDistance) {
+        // system peer: report its sample jitter
+        minDistance = r.distanceUs;
+        _sampleJitterUs = r.jitterUs;
+#if NTP_LEAP
+        _peerLeap = r.leap;
+#endif
+#if NTP_DNS_CACHE
+        _peerServer = r.server;
+        _peerAddress = r.address == 0xFF ? IPAddress()
+                                         : _addresses[r.server].ip[r.address];
+#endif
+      }
+      if (_stats.stratum == 0 || r.stratum < _stats.stratum) {
+        _stats.stratum = r.stratum;
+      }
+      if (r.poll > _serverPoll) _serverPoll = r.poll;
+    }
+    _stats.delayUs = static_cast<int32_t>(minDelay);
+    // smoothed round-trip time (as TCP: gain 1/8) for the attempt timeout
+    if (minDelay > 0) {
+      _srttUs = _srttUs == 0 ? static_cast<uint32_t>(minDelay)
+                             : static_cast<uint32_t>(
+                                   _srttUs + (minDelay - _srttUs) / 8);
+    }
+    if (_stats.minDelayUs == 0 || minDelay < _stats.minDelayUs) {
+      _stats.minDelayUs = _stats.delayUs;
+    }
+    offsetUs = reference + sum / weightSum;
+    return true;
+  }
+
+  /**
+   * @brief Clock filter (RFC 5905): mark the valid sample with the lowest
+   * round-trip delay of each server as best and determine the jitter of the
+   * samples of the server relative to it.
+   */
+  void clockFilter() {
+    for (int i = 0; i < _slotCount; i++) {
+      NTPRequest& r = _requests[i];
+      if (!r.valid) continue;
+      // is there a better sample of the same server?
+      bool best = true;
+      for (int j = 0; j < _slotCount && best; j++) {
+        const NTPRequest& o = _requests[j];
+        if (j == i || !o.valid || o.server != r.server) continue;
+        if (o.delayUs < r.delayUs || (o.delayUs == r.delayUs && j < i))
+          best = false;
+      }
+      r.best = best;
+      if (!best) continue;
+      // jitter: RMS of the offset differences
+      int64_t sum = 0;
+      int n = 0;
+      for (int j = 0; j < _slotCount; j++) {
+        const NTPRequest& o = _requests[j];
+        if (j == i || !o.valid || o.server != r.server) continue;
+        int64_t diff = o.offsetUs - r.offsetUs;
+        sum += diff * diff;
+        n++;
+      }
+      r.jitterUs = n > 0 ? static_cast<int32_t>(sqrtInt(sum / n)) : 0;
+    }
+  }
+
+  /** @brief Integer square root. */
+  static uint64_t sqrtInt(uint64_t value) {
+    uint64_t result = 0;
+    uint64_t bit = 1ULL << 62;
+    while (bit > value) bit >>= 2;
+    while (bit != 0) {
+      if (value >= result + bit) {
+        value -= result + bit;
+        result = (result >> 1) + bit;
+      } else {
+        result >>= 1;
+      }
+      bit >>= 2;
+    }
+    return result;
+  }
+
+  /**
+   * @brief Correct the local time by the indicated offset.
+   * @param offsetUs Offset in microseconds.
+   * @param adjustDrift Update the frequency estimate with the offset.
+   */
+  void applyOffset(int64_t offsetUs, bool adjustDrift = true) {
+    uint64_t tick = _clock.nowUs();
+#if NTP_LEAP
+    // the samples around the step of the servers mix both time scales
+    if (isLeapStep(tick)) return;
+    offsetUs += leapOffsetUs(tick);
+#endif
+    uint64_t now = _base.uncorrectedUs(tick);
+    // the offset after a restore is the error of the sleep timer
+    if (!_coldStart && !_restored && adjustDrift) {
+      discipline(offsetUs, tick - _base.tickUs);
+    }
+    _restored = false;
+    _base.tickUs = tick;
+    _base.timeUs = now + offsetUs;
+    _base.valid = true;
+    _stats.offsetUs = offsetUs;
+#if NTP_LEAP
+    // the completed correction becomes part of the time base
+    if (_base.leap != 0 &&
+        now >= _base.leapStartUs + _base.leapSmearMs * 1000ULL) {
+      _base.timeUs -= _base.leap * 1000000LL;
+      _base.leapStartUs = UINT64_MAX;
+      _base.leap = 0;
+    }
+#endif
+  }
+
+#if NTP_LEAP
+  /**
+   * @brief Schedule the leap second which is announced by the leap
+   * indicator (1: insert, 2: delete): leap seconds are only applied at the
+   * end of June and December, so an announcement in another month is
+   * ignored. An announcement which is withdrawn before the leap is
+   * cancelled.
+   */
+  void scheduleLeap(uint8_t li) {
+    uint64_t tick = _clock.nowUs();
+    if (isLeapStep(tick)) return;
+    if (li != 1 && li != 2) {
+      // the servers no longer announce the leap after it
+      if (_base.leap != 0 && _base.uncorrectedUs(tick) < leapStepUs()) {
+        _base.leapStartUs = UINT64_MAX;
+        _base.leap = 0;
+      }
+      return;
+    }
+    std::tm tm;
+    NTPCalendar::toTm(static_cast<int64_t>(_base.utcUs(tick) / 1000000ULL),
+                      tm);
+    if (tm.tm_mon != 5 && tm.tm_mon != 11) return;
+    // midnight after the end of the month
+    int32_t year = tm.tm_year + 1900 + (tm.tm_mon == 11 ? 1 : 0);
+    uint64_t leapUs = static_cast<uint64_t>(NTPCalendar::daysFromCivil(
+                          year, tm.tm_mon == 11 ? 1 : 7, 1)) *
+                      86400000000ULL;
+    _base.leap = li == 1 ? 1 : -1;
+    _base.leapSmearMs = _leapSmearMs;
+    if (_leapSmearMs > 0) {
+      _base.leapStartUs = leapUs - _leapSmearMs * 500ULL;
+    } else {
+      // 23:59:59 is repeated or skipped
+      _base.leapStartUs = _base.leap > 0 ? leapUs : leapUs - 1000000ULL;
+    }
+  }
+
+  /**
+   * @brief UTC (before the leap) at which the servers step their time:
+   * the start of a step or the leap in the middle of a smear.
+   */
+  uint64_t leapStepUs() const {
+    if (_base.leapSmearMs == 0) return _base.leapStartUs;
+    uint64_t leapUs = _base.leapStartUs + _base.leapSmearMs * 500ULL;
+    return _base.leap > 0 ? leapUs : leapUs - 1000000ULL;
+  }
+
+  /**  @brief The servers step their time within NTP_LEAP_GUARD_MS. */
+  bool isLeapStep(uint64_t tick) const {
+    if (_base.leap == 0) return false;
+    uint64_t utc = _base.uncorrectedUs(tick);
+    uint64_t step = leapStepUs();
+    uint64_t guard = NTP_LEAP_GUARD_MS * 1000ULL;
+    return utc + guard >= step && utc < step + 1000000ULL + guard;
+  }
+
+  /**
+   * @brief Correction of a measured offset while a leap second is
+   * scheduled: the time base stays in the time scale before the leap
+   * until the correction has completed, the servers step at the leap.
+   */
+  int64_t leapOffsetUs(uint64_t tick) const {
+    if (_base.leap == 0) return 0;
+    uint64_t utc = _base.uncorrectedUs(tick);
+    int64_t step = utc >= leapStepUs() ? _base.leap * 1000000LL : 0;
+    return step - _base.leapCorrectionUs(utc);
+  }
+#endif
+
+  /**
+   * @brief Clock discipline (frequency locked loop): the offset which was
+   * accumulated since the last update is the residual frequency error of the
+   * local oscillator. Steps and short intervals are ignored since they are
+   * dominated by the measurement noise.
+   * @param offsetUs Measured offset in microseconds.
+   * @param elapsedUs Local microseconds since the last update.
+   */
+  void discipline(int64_t offsetUs, uint64_t elapsedUs) {
+    if (elapsedUs < NTP_MIN_DRIFT_INTERVAL_MS * 1000ULL) return;
+    if (offsetUs > NTP_STEP_THRESHOLD_US || offsetUs < -NTP_STEP_THRESHOLD_US)
+      return;
+    int64_t residualPpb =
+        offsetUs * 1000000000LL / static_cast<int64_t>(elapsedUs);
+    int64_t drift = _base.driftPpb + residualPpb / NTP_DRIFT_GAIN;
+    if (drift > NTP_MAX_DRIFT_PPB) drift = NTP_MAX_DRIFT_PPB;
+    if (drift < -NTP_MAX_DRIFT_PPB) drift = -NTP_MAX_DRIFT_PPB;
+    _base.driftPpb = static_cast<int32_t>(drift);
+  }
+
+  /**
+   * @brief Report the result of an update: state, statistics and schedule.
+   */
+  void finish(NTPState state, NTPError error) {
+    _state = state;
+    _stats.error = error;
+    switch (state) {
+      case NTPState::RECEIVED:
+        _stats.successCount++;
+        break;
+      case NTPState::TIMEOUT:
+        _stats.timeoutCount++;
+        break;
+      default:
+        _stats.failureCount++;
+        break;
+    }
+    schedule(state == NTPState::RECEIVED);
+  }
+
+  /**
+   * @brief Determine the next poll interval (RFC 5905 poll adjust): the
+   * interval grows while the offset stays within the jitter and shrinks after
+   * a large offset or a step. Failures back off exponentially.
+   * @param success true if the update was successful.
    */
-  bool updateWithRTC() {
-    // Use system clock for transmit timestamp
-    uint32_t t0_unix = getTimeSec();           // seconds since 1970
-    uint32_t t0_ntp = t0_unix + 2208988800UL;  // seconds since 1900
-    return ntpExchange(t0_ntp);
+  void schedule(bool success) {
+    _scheduleTickUs = _clock.nowUs();
+    _scheduled = true;
+    if (!success) {
+      if (_failures < 32) _failures++;
+      _pollCount = 0;
+      return;
+    }
+    _failures = 0;
+    _rateLimited = false;
+    int64_t offset = _stats.offsetUs < 0 ? -_stats.offsetUs : _stats.offsetUs;
+    if (offset > NTP_STEP_THRESHOLD_US) {
+      // step: restart with the minimum interval
+      _pollExp = NTP_MIN_POLL;
+      _pollCount = 0;
+      _stats.jitterUs = 0;
+      return;
+    }
+    if (offset <= NTP_POLL_GATE * _stats.jitterUs) {
+      // stable: increase the interval after NTP_POLL_LIMIT good updates
+      if (++_pollCount >= NTP_POLL_LIMIT) {
+        _pollCount = 0;
+        if (_pollExp < NTP_MAX_POLL) _pollExp++;
+      }
+    } else {
+      // offset above the jitter: decrease the interval
+      _pollCount = 0;
+      if (_pollExp > NTP_MIN_POLL) _pollExp--;
+    }
+    // jitter: exponential average of the offsets
+    _stats.jitterUs += static_cast<int32_t>((offset - _stats.jitterUs) / 4);
+    // never poll faster than the server asks for
+    if (_serverPoll > _pollExp && _serverPoll <= NTP_MAX_POLL) {
+      _pollExp = _serverPoll;
+    }
   }
 
   /**
-   * @brief Log a formatted message (printf-style).
-   * @param format Format string (printf-style).
-   * @param ... Variable arguments.
+   * @brief Log a message to the logger defined with setLogger(): the
+   * arguments are printed one after the other (no printf formatting).
+   * Messages above NTP_LOG_LEVEL are removed by the compiler.
+   * @tparam LEVEL Log level (e.g. NTP_LOG_ERROR)
+   * @param args Values which can be printed with Print::print().
    */
-  void log(const char* format, ...) {
-    char buffer[128];
-    va_list args;
-    va_start(args, format);
-    vsnprintf(buffer, sizeof(buffer), format, args);
-    va_end(args);
-    Serial.print(buffer);
+#if NTP_LOG_LEVEL > NTP_LOG_NONE
+  template <int LEVEL, typename... Args>
+  void log(Args... args) {
+    if (LEVEL > NTP_LOG_LEVEL || _logger == nullptr) return;
+    logArgs(args...);
+    _logger->println();
+  }
+
+  void logArgs() {}
+
+  template <typename T, typename... Args>
+  void logArgs(T value, Args... args) {
+    _logger->print(value);
+    logArgs(args...);
   }
+#else
+  template <int LEVEL, typename... Args>
+  void log(Args...) {}
+#endif
 };
\ No newline at end of file
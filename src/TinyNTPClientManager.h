@@ -0,0 +1,493 @@
+
+/**
+ * @file TinyNTPClientManager.h
+ * @brief Many TinyNTPClient instances on one UDP socket: the responses are
+ * dispatched to the client which sent the request by the originate
+ * timestamp and the peer address, so that hundreds of references need
+ * neither hundreds of sockets nor threads.
+ */
+
+#pragma once
+#include <cstring>
+
+#include "TinyNTPClient.h"
+
+#if !NTP_REQUEST_TAG
+#error "TinyNTPClientManager needs NTP_REQUEST_TAG"
+#endif
+
+/// Default maximum number of clients of a manager
+#ifndef NTP_MANAGER_MAX_CLIENTS
+#define NTP_MANAGER_MAX_CLIENTS 16
+#endif
+
+/// Received packets which can wait for a client (per client)
+#ifndef NTP_MANAGER_QUEUE
+#define NTP_MANAGER_QUEUE 4
+#endif
+
+/// Outstanding requests per client (burst and retransmissions)
+#ifndef NTP_MANAGER_PENDING
+#define NTP_MANAGER_PENDING (2 * NTP_MAX_REQUESTS)
+#endif
+
+/// Entries of the request table which are searched for a timestamp
+#ifndef NTP_MANAGER_PROBES
+#define NTP_MANAGER_PROBES 8
+#endif
+
+/// Age after which an unanswered request is dropped from the table
+#ifndef NTP_MANAGER_EXPIRY_MS
+#define NTP_MANAGER_EXPIRY_MS 16000
+#endif
+
+/// Size of a queued packet: with the MAC, extension fields are truncated
+#ifndef NTP_MANAGER_PACKET_SIZE
+#if NTP_AUTH
+#define NTP_MANAGER_PACKET_SIZE (48 + NTP_MAC_SIZE)
+#else
+#define NTP_MANAGER_PACKET_SIZE 48
+#endif
+#endif
+
+/**
+ * @brief Detects bool wait(uint32_t timeoutMs) of an UDP API, which blocks
+ * until a packet can be read (e.g. with poll() or epoll_wait() on the
+ * socket). Specialize it for an UDP API which can not be changed.
+ */
+template <typename UDPAPI>
+struct NTPWaitTraits {
+  /**  @brief true if the UDP API can wait for packets. */
+  static constexpr bool available() { return has<UDPAPI>(nullptr); }
+
+  /**  @brief Wait for a packet: false on timeout or if not available. */
+  static bool wait(UDPAPI& udp, uint32_t timeoutMs) {
+    return call(udp, timeoutMs, NTPBool<has<UDPAPI>(nullptr)>());
+  }
+
+ protected:
+  template <typename U>
+  static constexpr bool has(decltype(&U::wait)) {
+    return true;
+  }
+  template <typename U>
+  static constexpr bool has(...) {
+    return false;
+  }
+  static bool call(UDPAPI& udp, uint32_t timeoutMs, NTPBool<true>) {
+    return udp.wait(timeoutMs);
+  }
+  static bool call(UDPAPI&, uint32_t, NTPBool<false>) { return false; }
+};
+
+/**
+ * @brief UDPAPI of a client of a TinyNTPClientManager: the requests are
+ * sent with the socket of the manager, the responses are queued by the
+ * manager. The receive timestamps are taken by the manager (and include
+ * the driver timestamps of the socket), so the time which a response waits
+ * in the queue does not bias the offset.
+ * @tparam MANAGER TinyNTPClientManager
+ */
+template <typename MANAGER>
+class NTPSharedUDP {
+ public:
+  /**  @brief The socket of the manager is bound by the manager. */
+  uint8_t begin(uint16_t port) {
+    _count = 0;
+    _listening = port != 0;
+    return _manager != nullptr && _manager->isBound();
+  }
+
+  /**  @brief Receive the broadcasts: the manager joins the group. */
+  uint8_t beginMulticast(IPAddress, uint16_t port) {
+    uint8_t result = begin(port);
+    _listening = true;
+    return result;
+  }
+
+  void stop() {
+    _count = 0;
+    _listening = false;
+  }
+
+  int beginPacket(IPAddress address, uint16_t port) {
+    if (_manager == nullptr) return 0;
+    _peer = address;
+    _hasPeer = true;
+    _len = 0;
+    return _manager->getUDP().beginPacket(address, port);
+  }
+
+  /**  @brief Send to a host name: the responses are not checked against
+   * the peer address. */
+  int beginPacket(const char* host, uint16_t port) {
+    if (_manager == nullptr) return 0;
+    _hasPeer = false;
+    _len = 0;
+    return _manager->getUDP().beginPacket(host, port);
+  }
+
+  size_t write(const uint8_t* data, size_t len) {
+    // keep the header for the transmit timestamp
+    size_t n = len < sizeof(_header) - _len ? len : sizeof(_header) - _len;
+    memcpy(_header + _len, data, n);
+    _len += n;
+    return _manager->getUDP().write(data, len);
+  }
+
+  /**  @brief Send the packet and register its transmit timestamp. */
+  int endPacket() {
+    int result = _manager->getUDP().endPacket();
+    if (result && _len == sizeof(_header)) {
+      _manager->track(_id, MANAGER::getTime(_header + 40),
+                      _hasPeer ? &_peer : nullptr);
+    }
+    return result;
+  }
+
+  /**
+   * @brief Provide the next queued packet: outside of the loop() of the
+   * manager the socket is read first, so that the blocking methods of the
+   * client work as well.
+   */
+  int parsePacket() {
+    if (_manager == nullptr) return 0;
+    if (_count == 0 && !_manager->isLooping()) _manager->receive();
+    if (_count == 0) return 0;
+    _current = _queue[_first];
+    _first = (_first + 1) % NTP_MANAGER_QUEUE;
+    _count--;
+    _pos = 0;
+    return _current.size;
+  }
+
+  int available() { return _current.len - _pos; }
+
+  int read(uint8_t* data, size_t len) {
+    int n = available() < static_cast<int>(len) ? available()
+                                                : static_cast<int>(len);
+    memcpy(data, _current.data + _pos, n);
+    _pos += n;
+    return n;
+  }
+
+  IPAddress remoteIP() { return _current.address; }
+
+  uint16_t remotePort() { return _current.port; }
+
+  /**  @brief Microseconds since the manager received the current packet. */
+  bool getRxAgeUs(uint32_t& ageUs) {
+    if (_manager == nullptr) return false;
+    ageUs = static_cast<uint32_t>(_manager->nowUs() - _current.receivedUs);
+    return true;
+  }
+
+  /**  @brief Driver timestamp of the socket of the manager. */
+  bool getTxAgeUs(uint32_t& ageUs) {
+    if (_manager == nullptr) return false;
+    return NTPTimestampTraits<typename MANAGER::Socket>::getTxAgeUs(
+        _manager->getUDP(), ageUs);
+  }
+
+  /**  @brief Number of packets which were dropped because the queue was
+   * full. */
+  uint32_t getDroppedCount() const { return _droppedCount; }
+
+ protected:
+  friend MANAGER;
+  struct Packet {
+    uint8_t data[NTP_MANAGER_PACKET_SIZE];
+    uint64_t receivedUs = 0;  ///< local tick of the arrival
+    IPAddress address;
+    uint16_t port = 0;
+    int size = 0;  ///< size of the received packet
+    int len = 0;   ///< bytes in data
+  };
+  MANAGER* _manager = nullptr;
+  Packet _queue[NTP_MANAGER_QUEUE];
+  Packet _current;
+  IPAddress _peer;
+  uint32_t _droppedCount = 0;
+  uint8_t _header[48];
+  size_t _len = 0;
+  int _pos = 0;
+  uint16_t _id = 0;
+  uint8_t _first = 0;
+  uint8_t _count = 0;
+  bool _hasPeer = false;
+  bool _listening = false;
+
+  void attach(MANAGER* manager, uint16_t id) {
+    _manager = manager;
+    _id = id;
+    _count = 0;
+  }
+
+  /**  @brief Queue a received packet: false if the queue is full. */
+  bool push(const uint8_t* data, int len, int size, uint64_t receivedUs,
+            IPAddress address, uint16_t port) {
+    if (_count >= NTP_MANAGER_QUEUE) {
+      _droppedCount++;
+      return false;
+    }
+    Packet& packet = _queue[(_first + _count++) % NTP_MANAGER_QUEUE];
+    memcpy(packet.data, data, len);
+    packet.len = len;
+    packet.size = size;
+    packet.receivedUs = receivedUs;
+    packet.address = address;
+    packet.port = port;
+    return true;
+  }
+};
+
+/**
+ * @brief Runs many TinyNTPClient instances (e.g. one per reference server)
+ * with one UDP socket. Each sent request is registered with its transmit
+ * timestamp in a hash table, and a response is queued at the client whose
+ * request matches its originate timestamp and peer address: each client
+ * tags its timestamps (see TinyNTPClient::setRequestTag()), so they are
+ * unique even if the clients send at the same time. Broadcasts
+ * (mode 5) are queued at the clients in listen-only mode. Call loop()
+ * frequently, e.g. after wait() on desktop systems: the clients must not
+ * be used from other threads. The clients have the type Client and are
+ * owned by the caller; begin() of the clients is not needed since loop()
+ * starts their first update.
+ * @tparam UDPAPI UDP API of the shared socket (e.g. WiFiUDP or
+ * NTPPosixUDP)
+ * @tparam MAX_CLIENTS Maximum number of clients
+ * @tparam CLOCK Clock policy of the clients (see TinyNTPClient)
+ * @tparam MAX_SERVERS Maximum number of servers per client
+ */
+template <typename UDPAPI, int MAX_CLIENTS = NTP_MANAGER_MAX_CLIENTS,
+          typename CLOCK = NTPArduinoClock,
+          int MAX_SERVERS = NTP_MAX_SERVERS>
+class TinyNTPClientManager {
+ public:
+  using Socket = UDPAPI;
+  using UDP = NTPSharedUDP<TinyNTPClientManager>;
+  using Client = TinyNTPClient<UDP, MAX_SERVERS, CLOCK>;
+
+  /**
+   * @brief Open the shared socket.
+   * @param port Local port (default: 0 = any)
+   * @return true if the port could be bound.
+   */
+  bool begin(uint16_t port = NTP_LOCAL_PORT) {
+    _udp.stop();
+    _bound = _udp.begin(port) != 0;
+    return _bound;
+  }
+
+  /**
+   * @brief Open the shared socket and join a multicast group (if the UDP
+   * API provides beginMulticast()) for clients in listen-only mode.
+   */
+  bool beginMulticast(IPAddress group, uint16_t port = 123) {
+    _udp.stop();
+    _bound = _udp.beginMulticast(group, port) != 0;
+    return _bound;
+  }
+
+  /**  @brief Close the shared socket. */
+  void end() {
+    _udp.stop();
+    _bound = false;
+  }
+
+  /**
+   * @brief Add a client: it must stay valid while the manager is used.
+   * @return false if MAX_CLIENTS clients have been added.
+   */
+  bool add(Client& client) {
+    if (_clientCount >= MAX_CLIENTS) return false;
+    client.getUDP().attach(this, static_cast<uint16_t>(_clientCount));
+    // clients which send at the same time use different timestamps
+    client.setRequestTag(static_cast<uint32_t>(_clientCount) * SLOTS);
+    _clients[_clientCount++] = &client;
+    return true;
+  }
+
+  /**
+   * @brief Dispatch the received packets and run loop() of all clients.
+   * @return Number of clients which completed an update
+   * (NTPState::RECEIVED).
+   */
+  int loop() {
+    _looping = true;
+    receive();
+    int result = 0;
+    for (int j = 0; j < _clientCount; j++) {
+      if (_clients[j]->loop() == NTPState::RECEIVED) result++;
+    }
+    _looping = false;
+    return result;
+  }
+
+  /**
+   * @brief Wait until a packet arrives: blocks in the UDP API if it
+   * provides wait() (see NTPWaitTraits), otherwise the socket is polled
+   * every millisecond. Use a timeout which is small compared to the
+   * attempt timeout of the clients (e.g. 10 ms).
+   * @return true if a packet is available, false on timeout.
+   */
+  bool wait(uint32_t timeoutMs) {
+    if (NTPWaitTraits<UDPAPI>::available()) {
+      return NTPWaitTraits<UDPAPI>::wait(_udp, timeoutMs);
+    }
+    uint64_t start = _clock.nowUs();
+    while (receive() == 0) {
+      if (_clock.nowUs() - start >= timeoutMs * 1000ULL) return false;
+      delay(1);
+    }
+    return true;
+  }
+
+  /**
+   * @brief Read all packets of the socket and queue them at the clients.
+   * @return Number of queued packets.
+   */
+  int receive() {
+    int result = 0;
+    int size;
+    while ((size = _udp.parsePacket()) > 0) {
+      // take the receive time before the packet is copied
+      uint32_t age;
+      if (!NTPTimestampTraits<UDPAPI>::getRxAgeUs(_udp, age)) age = 0;
+      uint64_t received = _clock.nowUs() - age;
+      uint8_t data[NTP_MANAGER_PACKET_SIZE];
+      int len = 0;
+      while (len < static_cast<int>(sizeof(data)) && _udp.available()) {
+        int n = _udp.read(data + len, sizeof(data) - len);
+        if (n <= 0) break;
+        len += n;
+      }
+      if (dispatch(data, len, size, received)) {
+        result++;
+      } else {
+        _unmatchedCount++;
+      }
+    }
+    return result;
+  }
+
+  /**  @brief Number of added clients. */
+  int getClientCount() const { return _clientCount; }
+
+  /**  @brief Access to an added client. */
+  Client& getClient(int index) { return *_clients[index]; }
+
+  /**  @brief Access to the shared socket. */
+  UDPAPI& getUDP() { return _udp; }
+
+  /**  @brief true if the shared socket is open. */
+  bool isBound() const { return _bound; }
+
+  /**  @brief true while loop() runs the clients. */
+  bool isLooping() const { return _looping; }
+
+  /**  @brief Local tick of the clock policy (microseconds). */
+  uint64_t nowUs() { return _clock.nowUs(); }
+
+  /**  @brief Number of packets which matched no request or whose client
+   * queue was full. */
+  uint32_t getUnmatchedCount() const { return _unmatchedCount; }
+
+  /**  @brief Read a timestamp of a packet (network byte order). */
+  static uint64_t getTime(const uint8_t* p) {
+    uint64_t result = 0;
+    for (int j = 0; j < 8; j++) result = result << 8 | p[j];
+    return result;
+  }
+
+ protected:
+  friend UDP;
+  static const int PENDING = MAX_CLIENTS * NTP_MANAGER_PENDING;
+  /// Request slots of a client (see TinyNTPClient::MAX_REQUESTS)
+  static const uint32_t SLOTS =
+      NTP_MAX_REQUESTS > MAX_SERVERS ? NTP_MAX_REQUESTS : MAX_SERVERS;
+
+  /**  @brief Outstanding request (txTm 0: free). */
+  struct Pending {
+    uint64_t txTm = 0;
+    uint32_t sentMs = 0;  ///< local tick of the request
+    IPAddress peer;
+    uint16_t client = 0;
+    bool hasPeer = false;
+  };
+  UDPAPI _udp;
+  CLOCK _clock;
+  Client* _clients[MAX_CLIENTS];
+  Pending _pending[PENDING];
+  uint32_t _unmatchedCount = 0;
+  int _clientCount = 0;
+  bool _bound = false;
+  bool _looping = false;
+
+  /**  @brief First table entry of a timestamp (Fibonacci hashing). */
+  static int home(uint64_t txTm) {
+    uint32_t hash = static_cast<uint32_t>(txTm ^ (txTm >> 32)) * 2654435761UL;
+    return static_cast<int>((static_cast<uint64_t>(hash) * PENDING) >> 32);
+  }
+
+  /**
+   * @brief Register a sent request: uses a free or expired entry near the
+   * home entry, otherwise the oldest one (its response is lost).
+   */
+  void track(uint16_t client, uint64_t txTm, const IPAddress* peer) {
+    if (txTm == 0) return;
+    uint32_t now = static_cast<uint32_t>(_clock.nowUs() / 1000ULL);
+    int start = home(txTm);
+    int oldest = start;
+    for (int j = 0; j < NTP_MANAGER_PROBES && j < PENDING; j++) {
+      int idx = (start + j) % PENDING;
+      Pending& entry = _pending[idx];
+      if (entry.txTm == 0 || now - entry.sentMs > NTP_MANAGER_EXPIRY_MS) {
+        oldest = idx;
+        break;
+      }
+      if (now - entry.sentMs > now - _pending[oldest].sentMs) oldest = idx;
+    }
+    Pending& entry = _pending[oldest];
+    entry.txTm = txTm;
+    entry.sentMs = now;
+    entry.client = client;
+    entry.hasPeer = peer != nullptr;
+    if (peer != nullptr) entry.peer = *peer;
+  }
+
+  /**
+   * @brief Queue a packet at the client of the matching request. The
+   * peer address is only checked if the request was sent to an address
+   * and the UDP API reports the sender.
+   */
+  bool dispatch(const uint8_t* data, int len, int size, uint64_t received) {
+    if (len < 48) return false;
+    IPAddress address = _udp.remoteIP();
+    uint16_t port = _udp.remotePort();
+    if ((data[0] & 0x07) == 5) {
+      bool result = false;
+      for (int j = 0; j < _clientCount; j++) {
+        UDP& udp = _clients[j]->getUDP();
+        if (udp._listening &&
+            udp.push(data, len, size, received, address, port)) {
+          result = true;
+        }
+      }
+      return result;
+    }
+    uint64_t originate = getTime(data + 24);
+    if (originate == 0) return false;
+    bool known = !(address == IPAddress());
+    int start = home(originate);
+    for (int j = 0; j < NTP_MANAGER_PROBES && j < PENDING; j++) {
+      Pending& entry = _pending[(start + j) % PENDING];
+      if (entry.txTm != originate) continue;
+      if (entry.hasPeer && known && !(entry.peer == address)) continue;
+      entry.txTm = 0;  // one response per request
+      return _clients[entry.client]->getUDP().push(data, len, size,
+                                                   received, address, port);
+    }
+    return false;
+  }
+};
@@ -0,0 +1,473 @@
+
+/**
+ * @file TinyNTPMockUDP.h
+ * @brief In-memory UDPAPI which simulates NTP servers behind a network with
+ * configurable delays, asymmetry, jitter, loss and clock drift in simulated
+ * time: for deterministic tests and benchmarks without a network.
+ */
+
+#pragma once
+#include <chrono>
+#include <cstring>
+
+#include "TinyNTPClient.h"
+
+/// Number of servers which can be configured individually
+#ifndef NTP_MOCK_MAX_SERVERS
+#define NTP_MOCK_MAX_SERVERS 4
+#endif
+
+/// Maximum number of responses in flight
+#ifndef NTP_MOCK_MAX_QUEUE
+#define NTP_MOCK_MAX_QUEUE 16
+#endif
+
+/// Maximum size of a packet: the NTP packet and the MAC
+#if NTP_AUTH
+#define NTP_MOCK_PACKET_SIZE (48 + NTP_MAC_SIZE)
+#else
+#define NTP_MOCK_PACKET_SIZE 48
+#endif
+
+/**
+ * @brief Simulated time and network: the true time only advances with
+ * advance() (or with NTPMockUDP::parsePacket()), the local clock
+ * runs with the configured drift and each server answers with its offset.
+ */
+class NTPMockNetwork {
+ public:
+  /**  @brief Behaviour of a simulated server and of the path to it. */
+  struct Server {
+    const char* host = nullptr;  ///< Host name (nullptr: default server)
+    uint32_t upUs = 10000;       ///< Delay client -> server
+    uint32_t downUs = 10000;     ///< Delay server -> client
+    uint32_t processUs = 100;    ///< Processing time of the server
+    uint32_t jitterUs = 0;       ///< Random additional delay per direction
+    uint8_t lossPercent = 0;     ///< Lost requests in percent
+    int64_t offsetUs = 0;        ///< Error of the server time
+    uint8_t stratum = 2;         ///< Stratum of the server
+    bool kissOfDeath = false;    ///< Answer with a RATE kiss-o'-death
+#if NTP_AUTH
+    /// Requests without a valid MAC of the key are not answered and the
+    /// packets are signed with it (nullptr: no authentication)
+    const NTPSymmetricKey* key = nullptr;
+    bool badMac = false;         ///< Flip a bit of the MAC of the packets
+#endif
+  };
+
+  /**  @brief Network used by default by NTPMockClock and NTPMockUDP. */
+  static NTPMockNetwork& instance() {
+    static NTPMockNetwork network;
+    return network;
+  }
+
+  /**
+   * @brief Configuration of a server: the default server is used for all
+   * hosts which have not been configured.
+   */
+  Server& server(const char* host = nullptr) {
+    if (host == nullptr) return _default;
+    for (int j = 0; j < _serverCount; j++) {
+      if (strcmp(_servers[j].host, host) == 0) return _servers[j];
+    }
+    if (_serverCount >= NTP_MOCK_MAX_SERVERS) return _default;
+    Server& result = _servers[_serverCount++];
+    result = _default;
+    result.host = host;
+    return result;
+  }
+
+  /**  @brief Frequency error of the local clock in parts per billion. */
+  void setDriftPpb(int32_t ppb) { _driftPpb = ppb; }
+
+  /**
+   * @brief Let the time advance with the real (steady) time as well: the
+   * clock then has the cost and resolution of a real clock.
+   */
+  void setRealTime(bool active) {
+    _skipUs = trueUs();
+    _realStartUs = realUs();
+    _realTime = active;
+  }
+
+  /**
+   * @brief Let a server send broadcasts (mode 5) in the indicated interval
+   * (0: off): they are received by the NTPMockUDP instances which are bound
+   * to the port.
+   */
+  void setBroadcast(uint32_t intervalMs, const char* host = nullptr,
+                    uint16_t port = 123) {
+    _broadcastIntervalUs = intervalMs * 1000ULL;
+    _broadcastHost = host;
+    _broadcastPort = port;
+  }
+
+  /**
+   * @brief Report exact receive timestamps with NTPMockUDP::getRxAgeUs()
+   * like a network driver (default: false).
+   */
+  void setDriverTimestamps(bool active) { _driverTimestamps = active; }
+
+  /**  @brief Set the unix time (microseconds) at the start (true time 0). */
+  void setStartTimeUs(uint64_t unixUs) { _startUs = unixUs; }
+
+  /**
+   * @brief Let the servers insert (+1) or delete (-1) a leap second before
+   * the indicated unix time (midnight): they announce it with the leap
+   * indicator during the last 24 hours, then 23:59:59 is repeated or
+   * skipped.
+   */
+  void setLeapSecond(uint64_t unixSec, int8_t leap) {
+    _leapUs = unixSec * 1000000ULL;
+    _leap = leap;
+  }
+
+  /**  @brief Advance the true time. */
+  void advance(uint64_t us) { _skipUs += us; }
+
+  /**  @brief True (simulated) microseconds since the start. */
+  uint64_t trueUs() const {
+    return _realTime ? _skipUs + realUs() - _realStartUs : _skipUs;
+  }
+
+  /**  @brief Local clock (microseconds) including the drift. */
+  uint64_t localUs() const {
+    uint64_t t = trueUs();
+    return t + static_cast<int64_t>(t) * _driftPpb / 1000000000LL;
+  }
+
+  /**  @brief Correct unix time in microseconds. */
+  uint64_t unixUs() const { return posixUs(_startUs + trueUs()); }
+
+  /**  @brief Time of a server in unix microseconds. */
+  uint64_t serverUs(const char* host = nullptr) const {
+    return unixUs() + find(host).offsetUs;
+  }
+
+  /**  @brief Number of requests received by the servers. */
+  uint32_t getRequestCount() const { return _requestCount; }
+
+  /**  @brief Deterministic pseudo random value in [0, range). */
+  uint32_t random(uint32_t range) {
+    _seed ^= _seed << 13;
+    _seed ^= _seed >> 17;
+    _seed ^= _seed << 5;
+    uint32_t value = _seed * 2654435761UL;  // scramble the low bits
+    return static_cast<uint32_t>((static_cast<uint64_t>(value) * range) >> 32);
+  }
+
+  /**  @brief Restart the simulation with the default configuration. */
+  void reset() { *this = NTPMockNetwork(); }
+
+ protected:
+  friend class NTPMockUDP;
+  Server _default;
+  Server _servers[NTP_MOCK_MAX_SERVERS];
+  uint64_t _startUs = 1700000000000000ULL;
+  uint64_t _leapUs = 0;
+  uint64_t _broadcastIntervalUs = 0;
+  const char* _broadcastHost = nullptr;
+  uint16_t _broadcastPort = 123;
+  uint64_t _skipUs = 0;
+  uint64_t _realStartUs = 0;
+  uint32_t _requestCount = 0;
+  uint32_t _seed = 2463534242UL;
+  int32_t _driftPpb = 0;
+  int8_t _leap = 0;
+  uint8_t _serverCount = 0;
+  bool _realTime = false;
+  bool _driverTimestamps = false;
+
+  /**  @brief Configuration of a host without adding it. */
+  const Server& find(const char* host) const {
+    for (int j = 0; host != nullptr && j < _serverCount; j++) {
+      if (strcmp(_servers[j].host, host) == 0) return _servers[j];
+    }
+    return _default;
+  }
+
+  /**  @brief Unix time after the leap second of the elapsed seconds. */
+  uint64_t posixUs(uint64_t elapsedUs) const {
+    if (_leap == 0 || elapsedUs < leapStepUs()) return elapsedUs;
+    return elapsedUs - _leap * 1000000LL;
+  }
+
+  /**  @brief Leap indicator of the servers at the elapsed seconds. */
+  uint8_t leapIndicator(uint64_t elapsedUs) const {
+    if (_leap == 0 || elapsedUs >= leapStepUs() ||
+        elapsedUs + 86400000000ULL < leapStepUs()) {
+      return 0;
+    }
+    return _leap > 0 ? 1 : 2;
+  }
+
+  uint64_t leapStepUs() const {
+    return _leap > 0 ? _leapUs : _leapUs - 1000000ULL;
+  }
+
+  static uint64_t realUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+};
+
+/**
+ * @brief Clock policy for TinyNTPClient: the local clock of a
+ * NTPMockNetwork (instead of millis()).
+ */
+class NTPMockClock {
+ public:
+  /**  @brief Microseconds of the local clock. */
+  uint64_t nowUs() const { return _network->localUs(); }
+
+  /**  @brief Use another network than NTPMockNetwork::instance(). */
+  void setNetwork(NTPMockNetwork& network) { _network = &network; }
+
+ protected:
+  NTPMockNetwork* _network = &NTPMockNetwork::instance();
+};
+
+/**
+ * @brief UDPAPI which sends the requests to the servers of a
+ * NTPMockNetwork: the responses can be read after the simulated delays.
+ * Each parsePacket() without result advances the time by up to the step
+ * (default 1 ms), so that blocking updates complete or time out.
+ */
+class NTPMockUDP {
+ public:
+  /**  @brief Use another network than NTPMockNetwork::instance(). */
+  void setNetwork(NTPMockNetwork& network) { _network = &network; }
+
+  /**  @brief Time step of parsePacket() (0: the time is not advanced). */
+  void setStepUs(uint32_t us) { _stepUs = us; }
+
+  uint8_t begin(uint16_t port) {
+    _port = port;
+    _broadcastPending = false;
+    return 1;
+  }
+
+  uint8_t beginMulticast(IPAddress, uint16_t port) { return begin(port); }
+
+  void stop() {
+    _count = 0;
+    _port = 0;
+    _broadcastPending = false;
+  }
+
+  int beginPacket(const char* host, uint16_t) {
+    _host = host;
+    _len = 0;
+    return 1;
+  }
+
+  /**  @brief Send to an address: the host name is the dotted address. */
+  int beginPacket(IPAddress address, uint16_t port) {
+    char* p = _address;
+    for (int j = 0; j < 4; j++) {
+      uint8_t v = address[j];
+      if (v >= 100) *p++ = '0' + v / 100;
+      if (v >= 10) *p++ = '0' + v / 10 % 10;
+      *p++ = '0' + v % 10;
+      *p++ = j < 3 ? '.' : 0;
+    }
+    return beginPacket(_address, port);
+  }
+
+  size_t write(const uint8_t* data, size_t len) {
+    if (len > sizeof(_request) - _len) len = sizeof(_request) - _len;
+    memcpy(_request + _len, data, len);
+    _len += len;
+    return len;
+  }
+
+  int endPacket() {
+    NTPMockNetwork& net = *_network;
+    const NTPMockNetwork::Server& server = net.find(_host);
+    if (_len < 48 || _count >= NTP_MOCK_MAX_QUEUE) return 1;
+    net._requestCount++;
+#if NTP_AUTH
+    if (server.key != nullptr && !authentic(*server.key)) return 1;
+#endif
+    if (net.random(100) < server.lossPercent) return 1;
+    uint64_t sent = net.trueUs();
+    uint64_t received = sent + server.upUs + net.random(server.jitterUs);
+    uint64_t transmitted = received + server.processUs;
+    Response& response = queue(server, 4, transmitted);
+    uint8_t* p = response.data;
+    memcpy(p + 24, _request + 40, 8);  // originate = client transmit
+    putTime(p + 32, net.posixUs(net._startUs + received) + server.offsetUs);
+    sign(server, response);
+    return 1;
+  }
+
+  /**  @brief Deliver the next response or advance the simulated time. */
+  int parsePacket() {
+    scheduleBroadcast();
+    if (_count == 0) {
+      _network->advance(_stepUs);  // e.g. until the timeout after a loss
+      return 0;
+    }
+    // deliver the response which arrives first
+    int next = _first;
+    for (int j = 1; j < _count; j++) {
+      int idx = (_first + j) % NTP_MOCK_MAX_QUEUE;
+      if (_queue[idx].arrivalUs < _queue[next].arrivalUs) next = idx;
+    }
+    uint64_t now = _network->trueUs();
+    if (_queue[next].arrivalUs > now) {
+      uint64_t step = _queue[next].arrivalUs - now;
+      _network->advance(step < _stepUs ? step : _stepUs);
+      return 0;
+    }
+    _current = _queue[next];
+    _queue[next] = _queue[_first];
+    _first = (_first + 1) % NTP_MOCK_MAX_QUEUE;
+    _count--;
+    _pos = 0;
+    if ((_current.data[0] & 0x07) == 5) _broadcastPending = false;
+    return _current.size;
+  }
+
+  /**
+   * @brief Microseconds since the arrival of the current packet (driver
+   * timestamp): see NTPMockNetwork::setDriverTimestamps().
+   */
+  bool getRxAgeUs(uint32_t& ageUs) {
+    if (!_network->_driverTimestamps) return false;
+    ageUs = static_cast<uint32_t>(_network->trueUs() - _current.arrivalUs);
+    return true;
+  }
+
+  /**  @brief The requests are sent immediately by endPacket(). */
+  bool getTxAgeUs(uint32_t& ageUs) {
+    if (!_network->_driverTimestamps) return false;
+    ageUs = 0;
+    return true;
+  }
+
+  /**  @brief The mock servers have no addresses. */
+  IPAddress remoteIP() { return IPAddress(); }
+
+  uint16_t remotePort() { return 123; }
+
+  int available() { return _current.size - _pos; }
+
+  int read(uint8_t* data, size_t len) {
+    int n = available() < static_cast<int>(len) ? available()
+                                                : static_cast<int>(len);
+    memcpy(data, _current.data + _pos, n);
+    _pos += n;
+    return n;
+  }
+
+ protected:
+  struct Response {
+    uint8_t data[NTP_MOCK_PACKET_SIZE];
+    int size = 0;
+    uint64_t arrivalUs = 0;  ///< true time of the arrival at the client
+  };
+  NTPMockNetwork* _network = &NTPMockNetwork::instance();
+  const char* _host = nullptr;
+  char _address[16];
+  Response _queue[NTP_MOCK_MAX_QUEUE];
+  Response _current;
+  uint8_t _request[NTP_MOCK_PACKET_SIZE];
+  size_t _len = 0;
+  uint32_t _stepUs = 1000;
+  int _first = 0;
+  int _count = 0;
+  int _pos = 0;
+  uint16_t _port = 0;
+  bool _broadcastPending = false;
+
+  /**
+   * @brief Queue a packet of the server which is transmitted at the
+   * indicated true time: the mode specific fields are filled in by the
+   * caller.
+   */
+  Response& queue(const NTPMockNetwork::Server& server, uint8_t mode,
+                  uint64_t transmitted) {
+    NTPMockNetwork& net = *_network;
+    uint64_t elapsed = net._startUs + transmitted;
+    uint64_t time = net.posixUs(elapsed) + server.offsetUs;
+    Response& response = _queue[(_first + _count++) % NTP_MOCK_MAX_QUEUE];
+    uint8_t* p = response.data;
+    memset(p, 0, 48);
+    response.size = 48;
+    p[0] = net.leapIndicator(elapsed) << 6 | 0x20 | mode;  // version 4
+    p[1] = server.kissOfDeath ? 0 : server.stratum;
+    memcpy(p + 12, server.kissOfDeath ? "RATE" : "MOCK", 4);
+    putTime(p + 16, time);
+    putTime(p + 40, time);
+    response.arrivalUs =
+        transmitted + server.downUs + net.random(server.jitterUs);
+    return response;
+  }
+
+  /**  @brief Append the MAC of the key of the server to a packet. */
+  void sign(const NTPMockNetwork::Server& server, Response& response) {
+#if NTP_AUTH
+    if (server.key == nullptr) return;
+    uint8_t* mac = response.data + 48;
+    computeMac(*server.key, response.data, mac);
+    if (server.badMac) mac[NTP_MAC_SIZE - 1] ^= 0x01;
+    response.size = 48 + NTP_MAC_SIZE;
+#else
+    (void)server;
+    (void)response;
+#endif
+  }
+
+#if NTP_AUTH
+  /**  @brief The request carries the MAC of the key. */
+  bool authentic(const NTPSymmetricKey& key) const {
+    if (_len != 48 + NTP_MAC_SIZE) return false;
+    uint8_t mac[NTP_MAC_SIZE];
+    computeMac(key, _request, mac);
+    return memcmp(mac, _request + 48, NTP_MAC_SIZE) == 0;
+  }
+
+  /**  @brief Key id and CMAC of the 48 bytes of a packet. */
+  static void computeMac(const NTPSymmetricKey& key, const uint8_t* packet,
+                         uint8_t* mac) {
+    for (int j = 0; j < 4; j++) {
+      mac[j] = static_cast<uint8_t>(key.getKeyId() >> (24 - 8 * j));
+    }
+    NTPCmac cmac(key);
+    cmac.update(packet, 48);
+    cmac.finish(mac + 4);
+  }
+#endif
+
+  /**
+   * @brief Keep the next broadcast in the queue while the port is bound to
+   * the broadcast port: lost broadcasts are skipped.
+   */
+  void scheduleBroadcast() {
+    NTPMockNetwork& net = *_network;
+    if (net._broadcastIntervalUs == 0 || _port != net._broadcastPort ||
+        _broadcastPending || _count >= NTP_MOCK_MAX_QUEUE) {
+      return;
+    }
+    const NTPMockNetwork::Server& server = net.find(net._broadcastHost);
+    // broadcasts are sent at multiples of the interval
+    uint64_t sent = net.trueUs();
+    do {
+      sent = (sent / net._broadcastIntervalUs + 1) * net._broadcastIntervalUs;
+    } while (net.random(100) < server.lossPercent);
+    sign(server, queue(server, 5, sent));
+    _broadcastPending = true;
+  }
+
+  static void putTime(uint8_t* p, uint64_t unixUs) {
+    uint32_t sec = static_cast<uint32_t>(unixUs / 1000000ULL + 2208988800ULL);
+    uint32_t frac =
+        static_cast<uint32_t>(((unixUs % 1000000ULL) << 32) / 1000000ULL);
+    for (int j = 0; j < 4; j++) {
+      p[j] = sec >> (24 - 8 * j);
+      p[4 + j] = frac >> (24 - 8 * j);
+    }
+  }
+};
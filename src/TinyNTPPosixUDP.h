@@ -0,0 +1,221 @@
+/**
+ * @file TinyNTPPosixUDP.h
+ * @brief UDPAPI with a non-blocking BSD socket (Linux, macOS) for desktop
+ * systems and gateways: wait() blocks in poll() until a packet arrives and
+ * the kernel receive timestamps (SO_TIMESTAMP) are reported as driver
+ * timestamps. IPAddress is provided by the Arduino API (e.g. the Arduino
+ * emulator).
+ */
+
+#pragma once
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include "TinyNTPClient.h"
+
+/// Maximum size of a sent or received packet
+#ifndef NTP_POSIX_PACKET_SIZE
+#define NTP_POSIX_PACKET_SIZE 512
+#endif
+
+/**
+ * @brief UDP API of the Arduino style (begin(), beginPacket(), write(),
+ * endPacket(), parsePacket(), read()) on a POSIX socket. The host names of
+ * beginPacket() are resolved with getaddrinfo() (IPv4).
+ */
+class NTPPosixUDP {
+ public:
+  NTPPosixUDP() = default;
+  NTPPosixUDP(const NTPPosixUDP&) = delete;
+  NTPPosixUDP& operator=(const NTPPosixUDP&) = delete;
+  ~NTPPosixUDP() { stop(); }
+
+  /**
+   * @brief Open the socket.
+   * @param port Local port (0: any)
+   * @return 1 if the socket could be bound, 0 otherwise.
+   */
+  uint8_t begin(uint16_t port) {
+    stop();
+    _fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (_fd < 0) return 0;
+    int on = 1;
+    setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(_fd, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
+    setsockopt(_fd, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on));
+    fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL, 0) | O_NONBLOCK);
+    sockaddr_in local = {};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons(port);
+    if (bind(_fd, reinterpret_cast<sockaddr*>(&local), sizeof(local)) != 0) {
+      stop();
+      return 0;
+    }
+    return 1;
+  }
+
+  /**  @brief Open the socket and join a multicast group. */
+  uint8_t beginMulticast(IPAddress group, uint16_t port) {
+    if (!begin(port)) return 0;
+    ip_mreq request = {};
+    request.imr_multiaddr.s_addr = toAddress(group);
+    request.imr_interface.s_addr = htonl(INADDR_ANY);
+    if (setsockopt(_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &request,
+                   sizeof(request)) != 0) {
+      stop();
+      return 0;
+    }
+    return 1;
+  }
+
+  void stop() {
+    if (_fd >= 0) close(_fd);
+    _fd = -1;
+    _size = 0;
+    _pos = 0;
+  }
+
+  int beginPacket(IPAddress address, uint16_t port) {
+    _destination = {};
+    _destination.sin_family = AF_INET;
+    _destination.sin_addr.s_addr = toAddress(address);
+    _destination.sin_port = htons(port);
+    _len = 0;
+    return _fd >= 0;
+  }
+
+  int beginPacket(const char* host, uint16_t port) {
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo* result = nullptr;
+    if (_fd < 0 || getaddrinfo(host, nullptr, &hints, &result) != 0) {
+      return 0;
+    }
+    _destination = *reinterpret_cast<sockaddr_in*>(result->ai_addr);
+    _destination.sin_port = htons(port);
+    freeaddrinfo(result);
+    _len = 0;
+    return 1;
+  }
+
+  size_t write(const uint8_t* data, size_t len) {
+    if (len > sizeof(_out) - _len) len = sizeof(_out) - _len;
+    memcpy(_out + _len, data, len);
+    _len += len;
+    return len;
+  }
+
+  size_t write(uint8_t value) { return write(&value, 1); }
+
+  int endPacket() {
+    ssize_t n = sendto(_fd, _out, _len, 0,
+                       reinterpret_cast<sockaddr*>(&_destination),
+                       sizeof(_destination));
+    return n == static_cast<ssize_t>(_len);
+  }
+
+  /**
+   * @brief Receive the next packet without blocking.
+   * @return Size of the packet, 0 if none is available.
+   */
+  int parsePacket() {
+    _size = 0;
+    _pos = 0;
+    if (_fd < 0) return 0;
+    iovec io = {_in, sizeof(_in)};
+    alignas(cmsghdr) uint8_t control[CMSG_SPACE(sizeof(timeval))];
+    msghdr message = {};
+    message.msg_name = &_source;
+    message.msg_namelen = sizeof(_source);
+    message.msg_iov = &io;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    ssize_t n = recvmsg(_fd, &message, 0);
+    if (n <= 0) return 0;
+    _size = static_cast<int>(n);
+    _stamped = false;
+    for (cmsghdr* c = CMSG_FIRSTHDR(&message); c != nullptr;
+         c = CMSG_NXTHDR(&message, c)) {
+      if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMP) {
+        memcpy(&_stamp, CMSG_DATA(c), sizeof(_stamp));
+        _stamped = true;
+      }
+    }
+    return _size;
+  }
+
+  int available() { return _size - _pos; }
+
+  int read(uint8_t* data, size_t len) {
+    int n = available() < static_cast<int>(len) ? available()
+                                                : static_cast<int>(len);
+    memcpy(data, _in + _pos, n);
+    _pos += n;
+    return n;
+  }
+
+  int read() { return available() > 0 ? _in[_pos++] : -1; }
+
+  IPAddress remoteIP() {
+    const uint8_t* p =
+        reinterpret_cast<const uint8_t*>(&_source.sin_addr.s_addr);
+    return IPAddress(p[0], p[1], p[2], p[3]);
+  }
+
+  uint16_t remotePort() { return ntohs(_source.sin_port); }
+
+  /**
+   * @brief Wait until a packet can be read.
+   * @return false on timeout.
+   */
+  bool wait(uint32_t timeoutMs) {
+    if (_fd < 0) return false;
+    pollfd fd = {_fd, POLLIN, 0};
+    return poll(&fd, 1, static_cast<int>(timeoutMs)) > 0;
+  }
+
+  /**  @brief Microseconds since the kernel received the current packet. */
+  bool getRxAgeUs(uint32_t& ageUs) {
+    timeval now;
+    if (!_stamped || gettimeofday(&now, nullptr) != 0) return false;
+    int64_t age = (static_cast<int64_t>(now.tv_sec) - _stamp.tv_sec) *
+                      1000000LL +
+                  (now.tv_usec - _stamp.tv_usec);
+    if (age < 0 || age > 1000000LL) return false;  // clock was set
+    ageUs = static_cast<uint32_t>(age);
+    return true;
+  }
+
+  /**  @brief File descriptor of the socket (e.g. for epoll), -1 if closed. */
+  int getSocket() const { return _fd; }
+
+ protected:
+  sockaddr_in _destination = {};
+  sockaddr_in _source = {};
+  timeval _stamp = {};
+  uint8_t _out[NTP_POSIX_PACKET_SIZE];
+  uint8_t _in[NTP_POSIX_PACKET_SIZE];
+  size_t _len = 0;
+  int _fd = -1;
+  int _size = 0;
+  int _pos = 0;
+  bool _stamped = false;
+
+  static in_addr_t toAddress(IPAddress address) {
+    uint8_t bytes[4] = {address[0], address[1], address[2], address[3]};
+    in_addr_t result;
+    memcpy(&result, bytes, sizeof(result));
+    return result;
+  }
+};
@@ -0,0 +1,249 @@
+
+/**
+ * @file TinyNTPServer.h
+ * @brief Lightweight SNTP server (RFC 4330): a node which is synchronized
+ * with a TinyNTPClient answers the requests of the local network and can
+ * send broadcasts, so that the other nodes do not need the internet.
+ */
+
+#pragma once
+#include "TinyNTPClient.h"
+
+/// Maximum number of requests which are answered by one call of loop()
+#ifndef NTP_SERVER_MAX_PACKETS
+#define NTP_SERVER_MAX_PACKETS 8
+#endif
+
+/// Precision of the local clock (log2 seconds): -20 = 1 microsecond
+#ifndef NTP_SERVER_PRECISION
+#define NTP_SERVER_PRECISION -20
+#endif
+
+/**
+ * @brief SNTP server which answers client requests (mode 3) with the time
+ * of a synchronized TinyNTPClient and optionally sends broadcasts (mode 5).
+ * It uses its own UDPAPI instance (socket), so it can run next to the
+ * client. Call loop() frequently: the receive timestamp is taken when the
+ * request is processed unless the UDP API provides driver timestamps (see
+ * NTPTimestampTraits).
+ * @tparam UDPAPI UDP API (e.g. WiFiUDP)
+ * @tparam CLIENT TinyNTPClient which provides the time
+ */
+template <typename UDPAPI, typename CLIENT>
+class TinyNTPServer {
+ public:
+  /**  @brief Serve the time of the indicated client. */
+  TinyNTPServer(CLIENT& client) : _client(client) {}
+
+  /**
+   * @brief Open the server port.
+   * @param port Local port (default: 123)
+   * @return true if the port could be bound.
+   */
+  bool begin(uint16_t port = 123) {
+    _udp.stop();
+    return _udp.begin(port) != 0;
+  }
+
+  /**  @brief Close the server port. */
+  void end() { _udp.stop(); }
+
+  /**
+   * @brief Send broadcasts (mode 5) in the indicated interval (0: off).
+   * @param address Broadcast or multicast address (e.g. 255.255.255.255 or
+   * 224.0.1.1)
+   * @param intervalMs Interval in milliseconds (e.g. 64000)
+   * @param port Destination port (default: 123)
+   */
+  void setBroadcast(IPAddress address, uint32_t intervalMs,
+                    uint16_t port = 123) {
+    _broadcastAddress = address;
+    _broadcastIntervalMs = intervalMs;
+    _broadcastPort = port;
+    _broadcastTickUs = 0;
+    _broadcastSent = false;
+  }
+
+  /**
+   * @brief Answer the pending requests and send the broadcast when it is
+   * due.
+   * @return Number of answered requests.
+   */
+  int loop() {
+    int result = 0;
+    for (int j = 0; j < NTP_SERVER_MAX_PACKETS; j++) {
+      int size = _udp.parsePacket();
+      if (size <= 0) break;
+      // T2: the driver timestamp or as early as possible
+      uint32_t age;
+      if (!NTPTimestampTraits<UDPAPI>::getRxAgeUs(_udp, age)) age = 0;
+      uint64_t receive = ntpTime(age);
+      if (answer(size, receive)) result++;
+    }
+    if (_broadcastIntervalMs > 0 && _client) {
+      uint64_t now = _client.getClock().nowUs();
+      if (!_broadcastSent ||
+          now - _broadcastTickUs >= _broadcastIntervalMs * 1000ULL) {
+        _broadcastTickUs = now;
+        _broadcastSent = broadcast();
+      }
+    }
+    return result;
+  }
+
+  /**
+   * @brief Send a broadcast (mode 5) to the address defined with
+   * setBroadcast().
+   * @return true if the packet was sent.
+   */
+  bool broadcast() {
+    if (!_client) return false;
+    uint8_t packet[48] = {};
+    header(packet, 4, 5);
+    packet[2] = pollExponent(_broadcastIntervalMs);
+    if (!_udp.beginPacket(_broadcastAddress, _broadcastPort)) return false;
+    putTime(packet + 40, ntpTime());
+    _udp.write(packet, sizeof(packet));
+#if NTP_AUTH
+    if (_key != nullptr) _key->write(_udp, packet);
+#endif
+    _udp.endPacket();
+    _broadcastCount++;
+    return true;
+  }
+
+#if NTP_AUTH
+  /**
+   * @brief Only answer requests with a valid MAC of the key and add the MAC
+   * to the responses and broadcasts. The key must stay valid while it is
+   * used.
+   */
+  void setKey(const NTPSymmetricKey& key) { _key = &key; }
+
+  /**  @brief Stop the authentication. */
+  void clearKey() { _key = nullptr; }
+#endif
+
+  /**  @brief Number of answered requests. */
+  uint32_t getRequestCount() const { return _requestCount; }
+
+  /**  @brief Number of sent broadcasts. */
+  uint32_t getBroadcastCount() const { return _broadcastCount; }
+
+  /**  @brief Access to the UDP API of the server. */
+  UDPAPI& getUDP() { return _udp; }
+
+ protected:
+  CLIENT& _client;
+  UDPAPI _udp;
+#if NTP_AUTH
+  const NTPSymmetricKey* _key = nullptr;
+#endif
+  IPAddress _broadcastAddress;
+  uint64_t _broadcastTickUs = 0;
+  uint32_t _broadcastIntervalMs = 0;
+  uint32_t _requestCount = 0;
+  uint32_t _broadcastCount = 0;
+  uint16_t _broadcastPort = 123;
+  bool _broadcastSent = false;
+
+  /**  @brief Answer a client request (mode 3). */
+  bool answer(int size, uint64_t receive) {
+    uint8_t packet[48];
+    if (size < static_cast<int>(sizeof(packet))) return false;
+    int len = 0;
+    while (len < static_cast<int>(sizeof(packet)) && _udp.available()) {
+      int n = _udp.read(packet + len, sizeof(packet) - len);
+      if (n <= 0) break;
+      len += n;
+    }
+    uint8_t mode = packet[0] & 0x07;
+    uint8_t version = (packet[0] >> 3) & 0x07;
+    if (len < 48 || mode != 3 || version < 1 || version > 4) return false;
+#if NTP_AUTH
+    if (_key != nullptr && !_key->verify(_udp, packet, size)) return false;
+#endif
+    // originate = transmit timestamp of the client
+    for (int j = 0; j < 8; j++) packet[24 + j] = packet[40 + j];
+    uint8_t poll = packet[2];
+    header(packet, version, 4);
+    if (poll != 0) packet[2] = poll;
+    putTime(packet + 32, receive);
+    if (!_udp.beginPacket(_udp.remoteIP(), _udp.remotePort())) return false;
+    putTime(packet + 40, ntpTime());  // T3: as late as possible
+    _udp.write(packet, sizeof(packet));
+#if NTP_AUTH
+    if (_key != nullptr) _key->write(_udp, packet);
+#endif
+    _udp.endPacket();
+    _requestCount++;
+    return true;
+  }
+
+  /**
+   * @brief Fill the header and the reference timestamp: the server is one
+   * stratum below the selected server. The caller sets the originate,
+   * receive and transmit timestamps.
+   */
+  void header(uint8_t* packet, uint8_t version, uint8_t mode) {
+    bool synced = _client;
+    NTPTimeBase base = _client.getTimeBase();
+    uint8_t li = synced ? _client.getLeapIndicator() : 3;
+    uint8_t stratum = synced ? _client.getStratum() + 1 : 16;
+    if (stratum > 16) stratum = 16;
+    packet[0] = static_cast<uint8_t>(li << 6 | version << 3 | mode);
+    packet[1] = stratum;
+    packet[2] = NTP_MIN_POLL;
+    packet[3] = static_cast<uint8_t>(NTP_SERVER_PRECISION);
+    // root delay: round trip to the upstream server
+    int32_t delay = _client.getDelayUs();
+    putShort(packet + 4, delay > 0 ? delay : 0);
+    // root dispersion: jitter and the frequency tolerance (15 ppm) since
+    // the last update
+    uint64_t age = synced ? _client.getClock().nowUs() - base.tickUs : 0;
+    uint64_t dispersion = static_cast<uint64_t>(_client.getJitterUs()) +
+                          NTP_MIN_DISPERSION_US + age * 15 / 1000000ULL;
+    putShort(packet + 8, dispersion);
+    memcpy(packet + 12, "TNTP", 4);  // reference id
+    putTime(packet + 16, synced ? toNtp(base.timeUs) : 0);
+  }
+
+  /**
+   * @brief UTC time of the client as NTP timestamp.
+   * @param ageUs Microseconds before now
+   */
+  uint64_t ntpTime(uint32_t ageUs = 0) {
+    NTPTimeBase base = _client.getTimeBase();
+    if (!base.valid) return 0;
+    return toNtp(base.utcUs(_client.getClock().nowUs()) - ageUs);
+  }
+
+  /**  @brief Unix microseconds to NTP 32.32 fixed point (since 1900). */
+  static uint64_t toNtp(uint64_t unixUs) {
+    uint64_t sec = unixUs / 1000000ULL + 2208988800ULL;
+    uint64_t frac = ((unixUs % 1000000ULL) << 32) / 1000000ULL;
+    return (sec << 32) | frac;
+  }
+
+  /**  @brief Interval as log2 seconds (at least 4 = 16 s). */
+  static uint8_t pollExponent(uint32_t intervalMs) {
+    uint8_t result = 4;
+    while (result < 17 && (1000UL << (result + 1)) <= intervalMs) result++;
+    return result;
+  }
+
+  static void putTime(uint8_t* p, uint64_t ntp) {
+    for (int j = 0; j < 8; j++) {
+      p[j] = static_cast<uint8_t>(ntp >> (56 - 8 * j));
+    }
+  }
+
+  /**  @brief Microseconds as NTP short format (16.16 seconds). */
+  static void putShort(uint8_t* p, uint64_t us) {
+    uint64_t value = (us << 16) / 1000000ULL;
+    if (value > UINT32_MAX) value = UINT32_MAX;
+    for (int j = 0; j < 4; j++) {
+      p[j] = static_cast<uint8_t>(value >> (24 - 8 * j));
+    }
+  }
+};
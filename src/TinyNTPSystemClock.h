@@ -0,0 +1,86 @@
+
+/**
+ * @file TinyNTPSystemClock.h
+ * @brief Optional sink which sets the system clock (POSIX, ESP-IDF) from a
+ * TinyNTPClient, so that time() and gettimeofday() report the NTP time.
+ */
+
+#pragma once
+#include <sys/time.h>
+
+#include "TinyNTPClient.h"
+
+/// Largest offset (us) which adjtime() accepts (glibc: about +/-2145 s)
+#ifndef NTP_ADJTIME_MAX_US
+#define NTP_ADJTIME_MAX_US 2145000000LL
+#endif
+
+/**
+ * @brief Sets the system clock from the time of a TinyNTPClient: offsets
+ * below NTP_STEP_THRESHOLD_US are slewed with adjtime(), so the system time
+ * never jumps, larger offsets are stepped with settimeofday(). Call sync()
+ * after each successful update. The process needs the permission to set the
+ * time (e.g. CAP_SYS_TIME on Linux).
+ */
+class NTPSystemClock {
+ public:
+  /**
+   * @brief Do not step the clock backward (default: false): large negative
+   * offsets are slewed as well, which can take a long time. Offsets beyond
+   * NTP_ADJTIME_MAX_US cannot be slewed: sync() then returns false and
+   * leaves the clock unchanged.
+   */
+  void setStepBackward(bool allowed) { _stepBackward = allowed; }
+
+  /**
+   * @brief Correct the system clock with the (UTC) time of the client.
+   * @param client TinyNTPClient or TinyNTPTimeService (any task).
+   * @return true if the system clock was adjusted.
+   */
+  template <typename CLIENT>
+  bool sync(CLIENT& client) {
+    NTPTimeBase base = client.getTimeBase();
+    if (!base.valid) return false;
+    timeval now;
+    if (gettimeofday(&now, nullptr) != 0) return false;
+    int64_t systemUs = static_cast<int64_t>(now.tv_sec) * 1000000LL +
+                       now.tv_usec;
+    int64_t ntpUs =
+        static_cast<int64_t>(base.utcUs(client.getClock().nowUs()));
+    _offsetUs = ntpUs - systemUs;
+    int64_t absOffset = _offsetUs < 0 ? -_offsetUs : _offsetUs;
+    _stepped = absOffset >= NTP_STEP_THRESHOLD_US &&
+               (_offsetUs > 0 || _stepBackward);
+    if (_stepped) {
+      timeval tv = toTimeval(ntpUs);
+      return settimeofday(&tv, nullptr) == 0;
+    }
+    if (absOffset > NTP_ADJTIME_MAX_US) return false;  // rejected by adjtime
+    timeval delta = toTimeval(_offsetUs);
+    return adjtime(&delta, nullptr) == 0;
+  }
+
+  /**  @brief Offset of the system clock corrected by the last sync(). */
+  int64_t getOffsetUs() const { return _offsetUs; }
+
+  /**  @brief The last sync() has stepped the clock (instead of slewing). */
+  bool isStepped() const { return _stepped; }
+
+ protected:
+  int64_t _offsetUs = 0;
+  bool _stepped = false;
+  bool _stepBackward = false;
+
+  static timeval toTimeval(int64_t us) {
+    timeval result;
+    int64_t sec = us / 1000000LL;
+    int64_t rest = us % 1000000LL;
+    if (rest < 0) {  // tv_usec must be positive
+      sec--;
+      rest += 1000000LL;
+    }
+    result.tv_sec = static_cast<time_t>(sec);
+    result.tv_usec = static_cast<suseconds_t>(rest);
+    return result;
+  }
+};
@@ -0,0 +1,230 @@
+
+/**
+ * @file TinyNTPTimeService.h
+ * @brief Thread-safe time service for multitasking (FreeRTOS, desktop): one
+ * task updates the time with a TinyNTPClient and any number of tasks read it
+ * lock-free.
+ */
+
+#pragma once
+#include <atomic>
+#include <chrono>
+
+#include "TinyNTPClient.h"
+
+/**
+ * @brief Clock policy based on std::chrono::steady_clock. It is stateless,
+ * so it can be called from several tasks at the same time (unlike
+ * NTPArduinoClock which extends millis()).
+ */
+class NTPStdClock {
+ public:
+  /**  @brief Microseconds since an arbitrary (fixed) point of time. */
+  uint64_t nowUs() const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+};
+
+#ifdef ESP32
+/// Default clock policy of the time service
+using NTPSharedClock = NTPESP32Clock;
+#else
+/// Default clock policy of the time service
+using NTPSharedClock = NTPStdClock;
+#endif
+
+/**
+ * @brief Shared time service: a single task (the updater) calls loop() or
+ * update() and publishes the new time base with one atomic store; any task
+ * can call getTimeMs() / getTimeUs() without blocking.
+ *
+ * The time base is published with a double buffered seqlock: the updater
+ * writes the buffer which is not in use and then advances the sequence
+ * number, readers copy the current buffer and retry if the sequence number
+ * has changed in the meantime (i.e. after any publication).
+ *
+ * The CLOCK is called by all readers, so it must be stateless (e.g.
+ * NTPESP32Clock or NTPStdClock).
+ */
+template <typename UDPAPI, int MAX_SERVERS = NTP_MAX_SERVERS,
+          typename CLOCK = NTPSharedClock>
+class TinyNTPTimeService {
+ public:
+  using Client = TinyNTPClient<UDPAPI, MAX_SERVERS, CLOCK>;
+
+  /**
+   * @brief Constructor.
+   * @param server NTP server hostname (default: "pool.ntp.org").
+   * @param port NTP server port (default: 123).
+   * @param timeoutMs Timeout for NTP response in milliseconds (default: 6000).
+   */
+  TinyNTPTimeService(const char* server = "pool.ntp.org", int port = 123,
+                     uint32_t timeoutMs = 6000)
+      : _client(server, port, timeoutMs) {}
+
+  /**
+   * @brief Initialize the client and publish the time (updater only).
+   * @return true if the initial update was successful.
+   */
+  bool begin() {
+    bool result = _client.begin();
+    publish();
+    return result;
+  }
+
+  /**  @brief Stop the client: readers get 0 again (updater only). */
+  void end() {
+    _client.end();
+    publish();
+  }
+
+  /**
+   * @brief Keep the time up to date without blocking (updater only): see
+   * TinyNTPClient::loop().
+   */
+  NTPState loop() {
+    NTPState result = _client.loop();
+    if (result == NTPState::RECEIVED || offsetChanged()) publish();
+    return result;
+  }
+
+  /**  @brief Blocking update (updater only): see TinyNTPClient::update(). */
+  bool update() {
+    bool result = _client.update();
+    if (result) publish();
+    return result;
+  }
+
+  /**
+   * @brief Define the time offset in seconds (updater only): it becomes
+   * visible to the readers immediately.
+   */
+  void setTimeOffsetSeconds(long offset) {
+    _client.setTimeOffsetSeconds(offset);
+    publish();
+  }
+
+#if NTP_TIMEZONE
+  /**
+   * @brief Define the time zone with a POSIX TZ string (updater only): the
+   * transitions are published by loop().
+   */
+  bool setTimeZone(const char* tz) {
+    bool result = _client.setTimeZone(tz);
+    publish();
+    return result;
+  }
+#endif
+
+  /**
+   * @brief Restore the state saved with TinyNTPClient::saveState() instead
+   * of begin() and publish it (updater only).
+   */
+  bool restoreState(const NTPSyncState& state, uint64_t rtcUs) {
+    bool result = _client.restoreState(state, rtcUs);
+    publish();
+    return result;
+  }
+
+  /**
+   * @brief Run the updater forever: calls loop() every loopMs milliseconds.
+   */
+  void run(uint32_t loopMs = 100) {
+    while (true) {
+      loop();
+      delay(loopMs);
+    }
+  }
+
+  /**
+   * @brief Task entry point (e.g. for xTaskCreate() or std::thread) which
+   * calls run() of the service passed as argument.
+   */
+  static void task(void* service) {
+    static_cast<TinyNTPTimeService*>(service)->run();
+  }
+
+#ifdef ESP32
+  /**
+   * @brief Start the updater as FreeRTOS task: the client must be configured
+   * (servers, offset) before.
+   * @return true if the task was created.
+   */
+  bool startTask(uint32_t stackSize = 4096, UBaseType_t priority = 1) {
+    return xTaskCreate(task, "ntp", stackSize, this, priority, nullptr) ==
+           pdPASS;
+  }
+#endif
+
+  /**  @brief Consistent copy of the last published time base (any task). */
+  NTPTimeBase getTimeBase() const {
+    NTPTimeBase result;
+    uint32_t seq;
+    do {
+      seq = _seq.load(std::memory_order_acquire);
+      result = _buffers[seq & 1];
+      std::atomic_thread_fence(std::memory_order_acquire);
+    } while (seq != _seq.load(std::memory_order_relaxed));
+    return result;
+  }
+
+  /**
+   * @brief Current time in microseconds since 1970 including the offset or 0
+   * if the time has not been initialized (any task).
+   */
+  uint64_t getTimeUs() const {
+    NTPTimeBase base = getTimeBase();
+    return base.timeUsAt(_client.getClock().nowUs());
+  }
+
+  /**  @brief Batch timestamping (any task): see NTPTimeSnapshot. */
+  NTPTimeSnapshot getSnapshot() const {
+    return NTPTimeSnapshot(getTimeBase(), _client.getClock().nowUs());
+  }
+
+  /**  @brief Current time in milliseconds since 1970 (any task). */
+  uint64_t getTimeMs() const { return getTimeUs() / 1000ULL; }
+
+  /**  @brief Current time in seconds since 1970 (any task). */
+  uint32_t getTimeSec() const {
+    return static_cast<uint32_t>(getTimeUs() / 1000000ULL);
+  }
+
+  /**  @brief The time has been initialized (any task). */
+  operator bool() const { return getTimeBase().valid; }
+
+  /**
+   * @brief The stateless clock of the time base (any task), e.g. for
+   * NTPSystemClock::sync().
+   */
+  const CLOCK& getClock() const { return _client.getClock(); }
+
+  /**
+   * @brief The wrapped client for the configuration and statistics: it must
+   * only be used by the updater.
+   */
+  Client& client() { return _client; }
+
+ protected:
+  Client _client;
+  NTPTimeBase _buffers[2];
+  std::atomic<uint32_t> _seq{0};
+
+  /**  @brief The offset of the time zone has changed since publish(). */
+  bool offsetChanged() {
+    return _client.getTimeBase().offsetSec !=
+           _buffers[_seq.load(std::memory_order_relaxed) & 1].offsetSec;
+  }
+
+  /**  @brief Publish the time base of the client (updater only). */
+  void publish() {
+    uint32_t next = _seq.load(std::memory_order_relaxed) + 1;
+    // readers of the last but one publication must see the new sequence
+    // number before they can see any write to its buffer
+    std::atomic_thread_fence(std::memory_order_release);
+    _buffers[next & 1] = _client.getTimeBase();
+    _seq.store(next, std::memory_order_release);
+  }
+};
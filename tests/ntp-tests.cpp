@@ -0,0 +1,631 @@
+// Regression tests of TinyNTPClient with the simulated network of
+// TinyNTPMockUDP.h: each test asserts concrete outcomes. The environment
+// variable NTP_TEST selects a single test (see CMakeLists.txt).
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include "Arduino.h"
+#include "TinyNTPClient.h"
+#include "TinyNTPMockUDP.h"
+#include "TinyNTPServer.h"
+
+using Client = TinyNTPClient<NTPMockUDP, 4, NTPMockClock>;
+NTPMockNetwork& network = NTPMockNetwork::instance();
+int failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+#define CHECK_RANGE(value, low, high) \
+  checkRange((value), (low), (high), #value, __LINE__)
+
+void check(bool ok, const char* text, int line) {
+  if (ok) return;
+  printf("  line %d: %s failed\n", line, text);
+  failures++;
+}
+
+void checkRange(int64_t value, int64_t low, int64_t high, const char* text,
+                int line) {
+  if (value >= low && value <= high) return;
+  printf("  line %d: %s = %lld not in [%lld, %lld]\n", line, text,
+         static_cast<long long>(value), static_cast<long long>(low),
+         static_cast<long long>(high));
+  failures++;
+}
+
+/// Error of the client time against the true time
+template <typename CLIENT>
+int64_t errorUs(CLIENT& ntp) {
+  return static_cast<int64_t>(ntp.getTimeUs() - network.unixUs());
+}
+
+/// Largest error of loop() until the indicated true time
+template <typename CLIENT>
+int64_t loopUntil(CLIENT& ntp, uint64_t trueUs, uint32_t stepUs = 1000) {
+  int64_t result = 0;
+  while (network.trueUs() < trueUs) {
+    ntp.loop();
+    network.advance(stepUs);
+    int64_t error = errorUs(ntp);
+    if (error < 0) error = -error;
+    if (error > result) result = error;
+  }
+  return result;
+}
+
+/// Symmetric and asymmetric paths: the asymmetry is half the difference
+void testOffset() {
+  network.reset();
+  network.setDriftPpb(20000);
+  Client ntp("ntp.test");
+  CHECK(ntp.begin());
+  CHECK_RANGE(errorUs(ntp), -200, 200);
+  CHECK_RANGE(ntp.getDelayUs(), 19000, 21000);
+  CHECK_RANGE(loopUntil(ntp, 3600000000ULL), 0, 2000);
+
+  network.reset();
+  network.server().upUs = 5000;
+  network.server().downUs = 25000;
+  Client asymmetric("ntp.test");
+  CHECK(asymmetric.begin());
+  CHECK_RANGE(errorUs(asymmetric), -10200, -9800);
+}
+
+/// A server with a wrong time is rejected by the clock selection
+void testFalseticker() {
+  network.reset();
+  network.server("a.test");
+  network.server("b.test").offsetUs = 300;
+  network.server("c.test").offsetUs = 500000;
+  Client ntp("a.test");
+  ntp.addServer("b.test");
+  ntp.addServer("c.test");
+  CHECK(ntp.begin());
+  CHECK_RANGE(errorUs(ntp), -200, 500);
+}
+
+/// Without a majority the round is rejected and the time is kept
+void testNoMajority() {
+  network.reset();
+  network.server("a.test").offsetUs = -500000;
+  network.server("b.test");
+  Client ntp("a.test");
+  ntp.addServer("b.test");
+  CHECK(!ntp.begin());
+  CHECK(!ntp);
+  CHECK(ntp.getStats().error == NTPError::NO_MAJORITY);
+  CHECK(ntp.getStats().rejectedCount == 2);
+
+  // warm client: one of two servers moves away
+  network.server("a.test").offsetUs = 0;
+  CHECK(ntp.update());
+  network.server("a.test").offsetUs = -300000;
+  network.advance(64000000);
+  CHECK(!ntp.update());
+  CHECK(ntp.getStats().error == NTPError::NO_MAJORITY);
+  CHECK_RANGE(errorUs(ntp), -2000, 2000);
+
+  // two against two
+  network.reset();
+  network.server("a.test").offsetUs = -200000;
+  network.server("b.test").offsetUs = -200000;
+  network.server("c.test");
+  network.server("d.test");
+  Client split("a.test");
+  split.addServer("b.test");
+  split.addServer("c.test");
+  split.addServer("d.test");
+  CHECK(!split.begin());
+  CHECK(split.getStats().error == NTPError::NO_MAJORITY);
+}
+
+int resolverCalls = 0;
+
+/// Pool which returns another address for each lookup
+bool resolvePool(const char*, IPAddress& result) {
+  resolverCalls++;
+  result = IPAddress(10, 0, 0, resolverCalls % 3 + 1);
+  return true;
+}
+
+/// A growing pool is resolved once per round, not once per request
+void testDnsCache() {
+  network.reset();
+  Client ntp("pool.test");
+  ntp.setResolver(resolvePool);
+  resolverCalls = 0;
+  CHECK(ntp.updateBurst(4));
+  CHECK(resolverCalls == 1);
+  CHECK(ntp.updateBurst(4));
+  CHECK(resolverCalls == 2);
+  // the retransmissions use the addresses of the round as well
+  network.server().lossPercent = 100;
+  ntp.setRetry(3, 100, false);
+  CHECK(!ntp.updateBurst(4));
+  CHECK(ntp.getStats().retryCount == 2);
+  CHECK(resolverCalls == 3);
+}
+
+/// A lost server does not hold up the replies of the others
+void testRetry() {
+  network.reset();
+  network.server("a.test");
+  network.server("b.test");
+  network.server("c.test").lossPercent = 100;
+  Client ntp("a.test");
+  ntp.addServer("b.test");
+  ntp.addServer("c.test");
+  // cold start: the attempt timeout adapts to the first response
+  CHECK(ntp.begin());
+  CHECK(ntp.getStats().retryCount == 2);
+  CHECK_RANGE(ntp.getStats().exchangeUs, 200000, 400000);
+  CHECK_RANGE(errorUs(ntp), -200, 200);
+
+  // the lost requests of a burst are not sent again to an answering server
+  network.reset();
+  network.server().lossPercent = 25;
+  Client burst("ntp.test");
+  burst.setRetry(3, 100, false);
+  CHECK(burst.updateBurst(4));
+  CHECK(burst.getStats().retryCount == 0);
+  CHECK_RANGE(burst.getStats().exchangeUs, 100000, 110000);
+}
+
+/// The burst uses the sample with the lowest delay
+void testClockFilter() {
+  network.reset();
+  network.server().jitterUs = 20000;
+  int64_t single = 0, burst = 0;
+  for (int j = 0; j < 50; j++) {
+    Client ntp("ntp.test");
+    CHECK(ntp.updateBurst(1));
+    single += ntp.getDelayUs();
+    CHECK(ntp.updateBurst(8));
+    burst += ntp.getDelayUs();
+    CHECK(ntp.getSampleJitterUs() > 0);
+  }
+  // the expected delay is 40 ms with one sample, 24.4 ms with 8
+  CHECK_RANGE(single / 50, 35000, 45000);
+  CHECK_RANGE(burst / 50, 20000, 29000);
+}
+
+/// The frequency locked loop learns the drift of the local clock
+void testDrift() {
+  network.reset();
+  network.setDriftPpb(-50000);
+  Client ntp("ntp.test");
+  CHECK(ntp.begin());
+  loopUntil(ntp, 4 * 3600000000ULL);
+  CHECK_RANGE(ntp.getDriftPpb(), 48000, 52000);
+  CHECK(ntp.getPollExponent() > NTP_MIN_POLL);
+  CHECK_RANGE(loopUntil(ntp, 8 * 3600000000ULL), 0, 2000);
+}
+
+/// Offset of a POSIX TZ string compared to the C library
+int32_t libcOffset(const char* tz, time_t t) {
+  setenv("TZ", tz, 1);
+  tzset();
+  std::tm local;
+  localtime_r(&t, &local);
+  return static_cast<int32_t>(local.tm_gmtoff);
+}
+
+/// Transitions of POSIX TZ strings as calculated by glibc
+void testTimeZone() {
+  const char* zones[] = {"CET-1CEST,M3.5.0,M10.5.0/3",
+                         "EST5EDT,M3.2.0,M11.1.0",
+                         "AEST-10AEDT,M10.1.0,M4.1.0/3", "<+0330>-3:30"};
+  for (const char* zone : zones) {
+    NTPTimeZone tz;
+    CHECK(tz.begin(zone));
+    int mismatches = 0;
+    // 2023 - 2026 every 15 minutes
+    for (int64_t t = 1672531200LL; t < 1798761600LL; t += 900) {
+      uint64_t utcUs = static_cast<uint64_t>(t) * 1000000ULL;
+      if (tz.offsetAt(utcUs) != libcOffset(zone, t)) mismatches++;
+    }
+    if (mismatches > 0) printf("  %s\n", zone);
+    CHECK_RANGE(mismatches, 0, 0);
+  }
+  NTPTimeZone tz;
+  CHECK(!tz.begin("CET-1CEST,M3.5.0"));
+  CHECK(!tz.begin("CET-1CEST,M13.5.0,M10.5.0"));
+
+  // the client switches at 2026-03-29 01:00 UTC
+  network.reset();
+  network.setStartTimeUs(1774745940000000ULL);  // 00:59 UTC
+  Client ntp("ntp.test");
+  CHECK(ntp.begin());
+  CHECK(ntp.setTimeZone("CET-1CEST,M3.5.0,M10.5.0/3"));
+  CHECK_RANGE(static_cast<int64_t>(ntp.getTimeUs() - network.unixUs()),
+              3600000000LL - 200, 3600000000LL + 200);
+  network.advance(120000000);
+  // the snapshot and the saved state do not depend on getTimeUs() calls
+  NTPTimeSnapshot snapshot = ntp.getSnapshot();
+  uint32_t tick = static_cast<uint32_t>(ntp.getClock().nowUs());
+  CHECK_RANGE(static_cast<int64_t>(snapshot.toUs(tick) - network.unixUs()),
+              7200000000LL - 200, 7200000000LL + 200);
+  NTPSyncState state;
+  CHECK(ntp.saveState(state, 0));
+  CHECK(state.offsetSec == 7200);
+  CHECK_RANGE(static_cast<int64_t>(ntp.getTimeUs() - network.unixUs()),
+              7200000000LL - 200, 7200000000LL + 200);
+  CHECK(ntp.getLocalTm().tm_isdst == 1);
+  // an invalid time zone falls back to UTC
+  CHECK(!ntp.setTimeZone("CET-1CEST,M3.5.0"));
+  CHECK_RANGE(errorUs(ntp), -200, 200);
+  CHECK(ntp.getTimeBase().offsetSec == 0);
+}
+
+/// Inserted leap second stepped at midnight and smeared over 2 hours
+void testLeapSecond() {
+  const uint64_t leap = 1798761600ULL;  // 2027-01-01
+  const uint32_t smears[] = {0, 7200000};
+  for (uint32_t smearMs : smears) {
+    network.reset();
+    network.setDriftPpb(20000);
+    network.setStartTimeUs((leap - 2 * 3600) * 1000000ULL);
+    network.setLeapSecond(leap, 1);
+    Client ntp("ntp.test");
+    ntp.setLeapSmear(smearMs);
+    CHECK(ntp.begin());
+    CHECK(ntp.getLeapIndicator() == (smearMs == 0 ? 1 : 0));
+    uint64_t last = 0;
+    int backwards = 0;
+    int64_t maxError = 0;
+    while (network.trueUs() < 4 * 3600000000ULL) {
+      ntp.loop();
+      network.advance(1000);
+      uint64_t now = ntp.getTimeUs();
+      if (now < last) backwards++;
+      last = now;
+      // the client and the servers do not step at the same microsecond
+      int64_t error = errorUs(ntp);
+      uint64_t sec = network.unixUs() / 1000000ULL;
+      if (error < 0) error = -error;
+      if (error > maxError && (sec + 1 < leap || sec > leap + 1)) {
+        maxError = error;
+      }
+    }
+    // the step repeats 23:59:59 once, the smear never goes backwards
+    CHECK(backwards == (smearMs == 0 ? 1 : 0));
+    CHECK_RANGE(maxError, smearMs == 0 ? 0 : 490000,
+                smearMs == 0 ? 2000 : 510000);
+    CHECK_RANGE(errorUs(ntp), -2000, 2000);
+    CHECK(ntp.getLeapIndicator() == 0);
+  }
+}
+
+/// NTP era rollover on 2036-02-07 06:28:16 UTC
+void testEraRollover() {
+  const uint64_t rollover = 2085978496ULL;
+  network.reset();
+  network.setDriftPpb(20000);
+  network.setStartTimeUs((rollover - 3600) * 1000000ULL);
+  Client ntp("ntp.test");
+  CHECK(ntp.begin());
+  CHECK_RANGE(loopUntil(ntp, 7200000000ULL), 0, 2000);
+  CHECK(ntp.getTimeSec() > rollover);
+  // cold start in the next era: placed by NTP_BUILD_TIME
+  Client cold("ntp.test");
+  CHECK(cold.begin());
+  CHECK_RANGE(errorUs(cold), -200, 200);
+}
+
+/// The time and the poll interval survive a deep sleep
+void testSaveRestore() {
+  network.reset();
+  network.setDriftPpb(20000);
+  Client ntp("ntp.test");
+  CHECK(ntp.begin());
+  loopUntil(ntp, 3600000000ULL);
+  NTPSyncState state;
+  uint64_t rtcUs = network.trueUs();
+  CHECK(ntp.saveState(state, rtcUs));
+  network.advance(60000000);  // sleep one minute
+  Client woken("ntp.test");
+  CHECK(woken.restoreState(state, rtcUs + 60000000));
+  CHECK_RANGE(errorUs(woken), -2000, 2000);
+  CHECK(woken.getDriftPpb() == ntp.getDriftPpb());
+  CHECK(woken.getPollExponent() == ntp.getPollExponent());
+  CHECK(!woken.needsUpdate());
+  state.timeUs++;  // corrupted
+  CHECK(!woken.restoreState(state, rtcUs));
+
+  // the error of the sleep timer does not change the drift
+  const int32_t rtcErrorsUs[] = {30000, -30000};
+  for (int32_t rtcErrorUs : rtcErrorsUs) {
+    CHECK(ntp.saveState(state, network.trueUs()));
+    network.advance(600000000);  // sleep ten minutes
+    Client restored("ntp.test");
+    CHECK(restored.restoreState(state, state.rtcUs + 600000000 + rtcErrorUs));
+    network.advance(64000000);
+    CHECK(restored.update());
+    CHECK(restored.getDriftPpb() == state.driftPpb);
+    CHECK_RANGE(errorUs(restored), -2000, 2000);
+    network.advance(64000000);
+    CHECK(restored.update());
+    CHECK_RANGE(restored.getDriftPpb(), state.driftPpb - 500,
+                state.driftPpb + 500);
+    CHECK_RANGE(restored.getStats().offsetUs, -2000, 2000);
+  }
+}
+
+/// AES-128-CMAC test vectors of RFC 4493
+void testCmac() {
+  const uint8_t key[16] = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+                           0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+  const uint8_t message[64] = {
+      0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e,
+      0x11, 0x73, 0x93, 0x17, 0x2a, 0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03,
+      0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51, 0x30,
+      0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19,
+      0x1a, 0x0a, 0x52, 0xef, 0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b,
+      0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10};
+  const struct {
+    size_t len;
+    uint8_t mac[16];
+  } vectors[] = {
+      {0, {0xbb, 0x1d, 0x69, 0x29, 0xe9, 0x59, 0x37, 0x28, 0x7f, 0xa3, 0x7d,
+           0x12, 0x9b, 0x75, 0x67, 0x46}},
+      {16, {0x07, 0x0a, 0x16, 0xb4, 0x6b, 0x4d, 0x41, 0x44, 0xf7, 0x9b, 0xdd,
+            0x9d, 0xd0, 0x4a, 0x28, 0x7c}},
+      {40, {0xdf, 0xa6, 0x67, 0x47, 0xde, 0x9a, 0xe6, 0x30, 0x30, 0xca, 0x32,
+            0x61, 0x14, 0x97, 0xc8, 0x27}},
+      {64, {0x51, 0xf0, 0xbe, 0xbf, 0x7e, 0x3b, 0x9d, 0x92, 0xfc, 0x49, 0x74,
+            0x17, 0x79, 0x36, 0x3c, 0xfe}}};
+  NTPSymmetricKey symmetricKey(1, key);
+  for (const auto& vector : vectors) {
+    uint8_t mac[16];
+    NTPCmac cmac(symmetricKey);
+    // in two pieces to cover the buffering of update()
+    cmac.update(message, vector.len / 3);
+    cmac.update(message + vector.len / 3, vector.len - vector.len / 3);
+    cmac.finish(mac);
+    CHECK(memcmp(mac, vector.mac, 16) == 0);
+  }
+}
+
+/// Number of broadcasts which correct the time within the milliseconds
+int listenFor(Client& ntp, uint32_t ms) {
+  int result = 0;
+  uint64_t endUs = network.trueUs() + ms * 1000ULL;
+  while (network.trueUs() < endUs) {
+    if (ntp.listen() == NTPState::RECEIVED) result++;
+  }
+  return result;
+}
+
+/// Signed exchanges and broadcasts: forged and unsigned packets are rejected
+void testAuth() {
+  const uint8_t secret[16] = {1, 2, 3, 4, 5, 6, 7, 8,
+                              9, 10, 11, 12, 13, 14, 15, 16};
+  const uint8_t other[16] = {16, 15, 14, 13, 12, 11, 10, 9,
+                             8, 7, 6, 5, 4, 3, 2, 1};
+  NTPSymmetricKey key(7, secret);
+  NTPSymmetricKey wrongKey(7, other);
+
+  network.reset();
+  network.server().key = &key;
+  Client ntp("ntp.test");
+  ntp.setKey(key);
+  CHECK(ntp.begin());
+  CHECK_RANGE(errorUs(ntp), -200, 200);
+  CHECK(ntp.getStats().rejectedCount == 0);
+
+  // a bit of the MAC is flipped
+  network.server().badMac = true;
+  network.advance(64000000);
+  CHECK(!ntp.update());
+  CHECK(ntp.getStats().error == NTPError::AUTHENTICATION);
+  CHECK(ntp.getStats().rejectedCount == 3);
+
+  // the server does not sign its replies
+  network.server().key = nullptr;
+  network.server().badMac = false;
+  CHECK(!ntp.update());
+  CHECK(ntp.getStats().error == NTPError::AUTHENTICATION);
+
+  // the server does not answer requests with another key
+  network.server().key = &key;
+  Client forged("ntp.test");
+  forged.setKey(wrongKey);
+  uint32_t requests = network.getRequestCount();
+  CHECK(!forged.begin());
+  CHECK(forged.getStats().error == NTPError::TIMEOUT);
+  CHECK(network.getRequestCount() == requests + 3);
+
+  // broadcasts: only the signed ones correct the time
+  network.reset();
+  network.server().key = &key;
+  network.setBroadcast(16000);
+  Client listener("ntp.test");
+  listener.setKey(key);
+  CHECK(listener.beginBroadcast());
+  CHECK(listenFor(listener, 20000) == 1);
+  network.server().badMac = true;
+  CHECK(listenFor(listener, 16000) == 1);  // in flight: still signed
+  uint32_t rejected = listener.getStats().rejectedCount;
+  CHECK(listenFor(listener, 40000) == 0);
+  CHECK(listener.getStats().rejectedCount >= rejected + 2);
+  CHECK(listener.getStats().error == NTPError::AUTHENTICATION);
+}
+
+/// Packet in flight to a side of PipeUDP
+struct PipePacket {
+  uint8_t data[NTP_MOCK_PACKET_SIZE];
+  int size = 0;
+};
+PipePacket pipe[2];
+
+/// UDP API which delivers the packets immediately to the other side
+template <int SIDE>
+class PipeUDP {
+ public:
+  uint8_t begin(uint16_t) { return 1; }
+  void stop() {}
+  int beginPacket(const char*, uint16_t) { return beginPacket(); }
+  int beginPacket(IPAddress, uint16_t) { return beginPacket(); }
+
+  size_t write(const uint8_t* data, size_t len) {
+    PipePacket& out = pipe[1 - SIDE];
+    if (len > sizeof(out.data) - _len) len = sizeof(out.data) - _len;
+    memcpy(out.data + _len, data, len);
+    _len += len;
+    return len;
+  }
+
+  int endPacket() {
+    pipe[1 - SIDE].size = static_cast<int>(_len);
+    return 1;
+  }
+
+  int parsePacket() {
+    if (pipe[SIDE].size == 0) return 0;
+    _in = pipe[SIDE];
+    pipe[SIDE].size = 0;
+    _pos = 0;
+    return _in.size;
+  }
+
+  int available() { return _in.size - _pos; }
+
+  int read(uint8_t* data, size_t len) {
+    int n = available() < static_cast<int>(len) ? available()
+                                                : static_cast<int>(len);
+    memcpy(data, _in.data + _pos, n);
+    _pos += n;
+    return n;
+  }
+
+  IPAddress remoteIP() { return IPAddress(10, 0, 0, 1 + SIDE); }
+  uint16_t remotePort() { return 123; }
+
+ protected:
+  PipePacket _in;
+  size_t _len = 0;
+  int _pos = 0;
+
+  int beginPacket() {
+    _len = 0;
+    pipe[1 - SIDE].size = 0;
+    return 1;
+  }
+};
+
+using Server = TinyNTPServer<PipeUDP<0>, Client>;
+using Downstream = TinyNTPClient<PipeUDP<1>, 1, NTPMockClock>;
+
+/// 32.32 timestamp at the offset of a packet
+uint64_t getTime(const uint8_t* p) {
+  uint64_t result = 0;
+  for (int j = 0; j < 8; j++) result = result << 8 | p[j];
+  return result;
+}
+
+/// Unix microseconds of a 32.32 timestamp of the current era
+int64_t toUnixUs(uint64_t ntp) {
+  return static_cast<int64_t>((ntp >> 32) - 2208988800ULL) * 1000000LL +
+         static_cast<int64_t>(((ntp & 0xFFFFFFFFULL) * 1000000ULL) >> 32);
+}
+
+/// Send a client request (mode 3) to the server: returns the reply size
+int request(Server& server, uint8_t version, uint8_t poll) {
+  uint8_t packet[48] = {};
+  packet[0] = static_cast<uint8_t>(version << 3 | 3);
+  packet[2] = poll;
+  for (int j = 0; j < 8; j++) packet[40 + j] = static_cast<uint8_t>(0xA0 + j);
+  memcpy(pipe[0].data, packet, sizeof(packet));
+  pipe[0].size = sizeof(packet);
+  pipe[1].size = 0;
+  return server.loop() == 1 ? pipe[1].size : 0;
+}
+
+/// Replies of the server: header, timestamps and an unsynchronized source
+void testServer() {
+  network.reset();
+  network.server().stratum = 2;
+  Client upstream("ntp.test");
+  Server server(upstream);
+  CHECK(server.begin());
+
+  // the time source is not synchronized: alarm condition
+  CHECK(request(server, 4, 0) == 48);
+  const uint8_t* reply = pipe[1].data;
+  CHECK((reply[0] >> 6) == 3);
+  CHECK(reply[1] == 16);
+  CHECK(getTime(reply + 16) == 0);  // reference
+  CHECK(getTime(reply + 40) == 0);  // transmit
+  Downstream client("server.test");
+  CHECK(client.startUpdate());
+  server.loop();
+  CHECK(client.poll() == NTPState::FAILED);
+  CHECK(client.getStats().error == NTPError::UNSYNCHRONIZED);
+  CHECK(!client);
+
+  CHECK(upstream.begin());
+  network.advance(1000000);
+  CHECK(request(server, 3, 6) == 48);
+  CHECK((reply[0] >> 6) == 0);
+  CHECK(((reply[0] >> 3) & 0x07) == 3);  // version of the request
+  CHECK((reply[0] & 0x07) == 4);
+  CHECK(reply[1] == 3);  // one stratum below the upstream server
+  CHECK(reply[2] == 6);  // poll of the request
+  CHECK(memcmp(reply + 12, "TNTP", 4) == 0);
+  for (int j = 0; j < 8; j++) CHECK(reply[24 + j] == 0xA0 + j);  // origin
+  int64_t now = static_cast<int64_t>(network.unixUs());
+  CHECK_RANGE(toUnixUs(getTime(reply + 16)) - now, -1001000, -999000);
+  CHECK_RANGE(toUnixUs(getTime(reply + 32)) - now, -1000, 1000);
+  CHECK_RANGE(toUnixUs(getTime(reply + 40)) - now, -1000, 1000);
+  CHECK(getTime(reply + 40) >= getTime(reply + 32));
+  CHECK(server.getRequestCount() == 3);  // incl. the unsynchronized replies
+
+  // other modes are not answered
+  uint8_t* packet = pipe[0].data;
+  memset(packet, 0, 48);
+  packet[0] = 4 << 3 | 4;
+  pipe[0].size = 48;
+  CHECK(server.loop() == 0);
+
+  // a downstream client synchronizes with the server
+  CHECK(client.startUpdate());
+  server.loop();
+  CHECK(client.poll() == NTPState::RECEIVED);
+  CHECK(client.getStratum() == 3);
+  CHECK_RANGE(errorUs(client), -1000, 1000);
+}
+
+const struct {
+  const char* name;
+  void (*run)();
+} tests[] = {{"offset", testOffset},
+             {"falseticker", testFalseticker},
+             {"no-majority", testNoMajority},
+             {"dns-cache", testDnsCache},
+             {"retry", testRetry},
+             {"clock-filter", testClockFilter},
+             {"drift", testDrift},
+             {"timezone", testTimeZone},
+             {"leap-second", testLeapSecond},
+             {"era-rollover", testEraRollover},
+             {"save-restore", testSaveRestore},
+             {"cmac", testCmac},
+             {"auth", testAuth},
+             {"server", testServer}};
+
+void setup() {
+  const char* selected = getenv("NTP_TEST");
+  int count = 0;
+  for (const auto& test : tests) {
+    if (selected != nullptr && strcmp(selected, test.name) != 0) continue;
+    int before = failures;
+    test.run();
+    printf("%s: %s\n", test.name, failures == before ? "ok" : "FAILED");
+    count++;
+  }
+  if (count == 0) printf("unknown test %s\n", selected);
+  exit(failures == 0 && count > 0 ? 0 : 1);
+}
+
+void loop() {}